@@ -1,8 +1,17 @@
 #include <SDL2/SDL.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <limits.h>
 #include <math.h>
 #include <time.h>
 #include <omp.h>
+#include <stdint.h>
+#if defined(__AVX2__) || defined(__AVX512F__)
+#include <immintrin.h>
+#elif defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define GRID_SIZE 40
 #define SCALE 1.0f
@@ -10,16 +19,137 @@
 #define GRAVITY -0.02f
 #define BOUNCE 0.7f
 #define SPAWN_INTERVAL 1
+#define DEF_HEADLESS_FRAMES 600
+
+// Física con paso fijo: las constantes por paso (GRAVITY, velocidades, 0.05 de tiempo de ola)
+// están en unidades de un paso a PHYSICS_BASE_HZ; a otra frecuencia se escalan por el paso
+#define PHYSICS_BASE_HZ 60
+#define MAX_PHYSICS_STEPS 8     // pasos por frame como máximo; el resto del atraso se descarta
+#define WAVE_TIME_STEP 0.05f    // avance del tiempo de la ola por paso base
+
+// Esferas en estructura de arreglos (SoA): la física solo recorre los arreglos que usa
+#define SPHERE_ALIGN 64     // alineación de los arreglos (una línea de caché / un registro AVX-512)
+#define PHYSICS_BLOCK 256   // esferas por bloque del kernel de integración
+#define COLLIDE_CHUNK 64    // esferas por tarea de detección y aplicación
+#define DEPTH_CLEAR 1e30f   // profundidad de un pixel vacío
+
+// Reposo: una esfera apoyada en el terreno y casi quieta deja de integrarse y solo sigue la ola
+#define SLEEP_FRAMES 30             // frames seguidos en reposo antes de dormir
+#define SLEEP_SPEED 0.02f           // velocidad horizontal máxima para contar como reposo
+#define SLEEP_CONTACT 0.05f         // distancia máxima al piso para contar como apoyada
+#define SLEEP_TERRAIN_ACCEL 0.02f   // aceleración del piso que despierta a la esfera (|GRAVITY|)
+#define SLEEP_WAKE_SPEED 0.08f      // velocidad relativa con la que una despierta despierta a otra
+#define GROUND_FRICTION 0.7f        // fracción de la velocidad horizontal que queda al tocar el piso
+#define GROUND_STICK 0.1f           // por debajo de esta velocidad contra el piso no rebota
+
+// Contactos: se conservan entre pasos y se resuelven con varias iteraciones
+#define MAX_CONTACTS 16         // pares guardados por esfera (12 esferas iguales la tocan como máximo)
+#define CONTACT_MARGIN 0.05f    // separación hasta la que un par sigue en la caché
+#define WARM_START 0.8f         // fracción del impulso anterior con la que arranca un par
+#define DEF_CONTACT_ITERS 2     // iteraciones de resolución por paso
+
+// Reordenamiento por curva Z del almacén de esferas
+#define REORDER_FRAMES 32   // frames entre reordenamientos por defecto (0 = nunca)
+#define RADIX_BITS 8
+#define RADIX_BUCKETS (1 << RADIX_BITS)
 
 typedef struct {
-    float x,y,z;
-    float vx,vy,vz;
-    float radius;
     float r,g,b;
-    int active;
-} Sphere;
+} SphereColor;
 
-Sphere spheres[DEF_SPHERES];
+typedef struct {
+    int capacity;               // elementos reservados, múltiplo de 16
+    float *x, *y, *z;
+    float *vx, *vy, *vz;
+    float *prevX, *prevY, *prevZ;   // posición al inicio del último paso, para interpolar
+    float *radius;
+    SphereColor *color;         // datos fríos, solo los usa el render
+    int activeCount;            // las esferas activas ocupan [0, activeCount)
+    int awakeCount;             // despiertas en [0, awakeCount), dormidas en [awakeCount, activeCount)
+    float *floorY, *floorVel;   // altura del piso bajo la esfera y su cambio en el último paso
+    Uint8 *sleepFrames;         // frames seguidos en reposo
+    Uint8 *flip;                // 1 = cambiar de estado al final del paso (dormir o despertar)
+    int *slotOf;                // id estable -> posición actual en los arreglos
+    int *idOf;                  // posición -> id estable
+} SphereStore;
+
+SphereStore spheres = {0};
+
+// Copia de lo que dibuja el render: mientras se rasteriza un frame la física ya avanza el
+// siguiente sobre el almacenamiento, así que el render nunca lee spheres directamente
+typedef struct {
+    int capacity;
+    int count, sleeping;            // esferas activas y cuántas de ellas duermen
+    float *x, *y, *z;
+    float *prevX, *prevY, *prevZ;
+    float *radius;
+    SphereColor *color;
+    float alpha;                    // fracción del paso para interpolar
+    float renderT;                  // tiempo de la ola interpolado
+} SphereSnapshot;
+
+SphereSnapshot snapshots[2];                // doble buffer: una la escribe la física, otra la lee el render
+const SphereSnapshot* drawSpheres = NULL;   // instantánea del frame que se está dibujando
+
+// Grid uniforme (hash espacial) para la fase amplia de colisiones
+typedef struct {
+    int tableSize;      // número de cubetas, potencia de 2
+    int capacity;       // esferas que caben en sortedIdx/sphereCell
+    float cellSize;     // lado de la celda, al menos el diámetro de la esfera
+    int *cellStart;     // inicio de cada cubeta en sortedIdx (tableSize+1)
+    int *sortedIdx;     // índices de esferas ordenados por cubeta
+    int *sphereCell;    // cubeta de cada esfera (-1 si está inactiva)
+} SpatialGrid;
+
+SpatialGrid grid = {0};
+
+// Barrido y poda (sweep and prune) sobre el eje horizontal más extendido: alternativa al grid
+// para escenas donde las esferas se amontonan en los valles de la ola y llenan pocas celdas
+typedef struct {
+    int capacity;
+    int axis;           // 0 = x, 1 = z
+    int *ids;           // todas las esferas ordenadas por el eje, se conserva entre pasos
+    float *keys;        // coordenada de cada entrada de ids
+    int count;          // activas del paso, en el mismo orden
+    int *slots;         // slot de cada activa en orden del eje
+    float *xs;          // coordenada de cada activa en orden del eje
+    int *rankOf;        // posición en slots de cada slot activo
+    int sorted;         // ids ya está ordenado (basta una pasada de inserción)
+} SweepAndPrune;
+
+SweepAndPrune sweep = {0};
+
+enum { BROADPHASE_GRID, BROADPHASE_SAP };
+int broadphase = BROADPHASE_GRID;
+float broadphaseMaxRadius = 0.0f;   // radio máximo de las activas en el paso
+
+// Correcciones de colisión acumuladas por esfera (fase de detección -> fase de aplicación)
+typedef struct {
+    float dx, dy, dz;
+    float dvx, dvy, dvz;
+} CollisionBuffer;
+
+CollisionBuffer* collisionBuf = NULL;
+
+// Caché de contactos: los pares de cada esfera con su impulso normal acumulado. La parte
+// persistente va por id estable (sobrevive al reordenamiento; dormir o despertar la vacía); la
+// del paso va por slot y la arma la detección
+typedef struct {
+    int capacity;
+    int *other;         // id del otro extremo de cada par, MAX_CONTACTS por id
+    float *lambda;      // impulso acumulado del par al final del último paso
+    Uint8 *count;       // pares guardados de cada id
+    int *stepSlot;      // slot del otro extremo en este paso, MAX_CONTACTS por slot
+    float *stepLambda;  // impulso del par durante las iteraciones del paso
+    Uint8 *stepCount;
+} ContactCache;
+
+ContactCache contacts = {0};
+int contactIterations = DEF_CONTACT_ITERS;
+int* sleepScratch = NULL;       // ids a dormir y cola de la isla a despertar
+int sleepScratchCapacity = 0;
+Uint8* stepDeps = NULL;         // marcas del grafo de tareas de un paso: solo importan sus direcciones
+int stepDepsCapacity = 0;
 
 int numSpheres = 1;
 int gridSize = GRID_SIZE;
@@ -33,6 +163,107 @@ SDL_Texture* screenTexture = NULL;
 Uint32* frameBuffer = NULL;
 float* zbuffer = NULL;
 
+// ===== Instrumentación por etapa =====
+// Cada etapa del frame se mide con stageBegin/stageEnd (contador monotónico de SDL)
+// y se acumula en un histograma logarítmico para sacar p50/p95/p99 al salir.
+enum {
+    STAGE_SPAWN, STAGE_CAMERA, STAGE_INTEGRATE, STAGE_COLLIDE, STAGE_REORDER, STAGE_SNAPSHOT, STAGE_PHYSICS_WAIT,
+    STAGE_TERRAIN, STAGE_CLEAR, STAGE_RASTER_TERRAIN, STAGE_SPLAT_SPHERES, STAGE_UPLOAD,
+    STAGE_PRESENT, STAGE_FRAME,
+    NUM_STAGES
+};
+static const char* stageNames[NUM_STAGES] = {
+    "spawn", "camara", "integrar", "colisiones", "reordenar", "instantanea", "espera_fisica",
+    "terreno", "limpieza", "raster_terreno", "esferas", "subir_textura",
+    "presentar", "frame"
+};
+
+// 8 cubetas por cada potencia de 2 de microsegundos (error relativo < 7%), hasta ~16 s
+#define HIST_SUB 8
+#define HIST_OCTAVES 24
+#define HIST_BUCKETS (HIST_SUB * HIST_OCTAVES)
+
+typedef struct {
+    Uint64 start;           // contador al entrar a la etapa
+    Uint64 count;
+    double totalMs, maxMs;
+    Uint32 hist[HIST_BUCKETS];
+} StageStats;
+
+StageStats stageStats[NUM_STAGES];
+
+static inline void stageBegin(int stage){
+    stageStats[stage].start = SDL_GetPerformanceCounter();
+}
+
+// cubeta de un tiempo en microsegundos: exponente y subdivisión lineal de la mantisa
+static inline int histBucket(double us){
+    if(us < 1.0) return 0;
+    int e;
+    double m = frexp(us, &e);   // us = m * 2^e, m en [0.5, 1)
+    int b = (e-1)*HIST_SUB + (int)((m-0.5)*2*HIST_SUB);
+    return b < HIST_BUCKETS ? b : HIST_BUCKETS-1;
+}
+
+static inline void stageEnd(int stage){
+    StageStats* st = &stageStats[stage];
+    double us = (double)(SDL_GetPerformanceCounter()-st->start)*1e6/SDL_GetPerformanceFrequency();
+    st->count++;
+    st->totalMs += us/1000.0;
+    if(us/1000.0 > st->maxMs) st->maxMs = us/1000.0;
+    st->hist[histBucket(us)]++;
+}
+
+// percentil p (0..1) en ms: centro de la cubeta donde se alcanza p*count muestras
+double stagePercentile(const StageStats* st, double p){
+    if(st->count==0) return 0.0;
+    Uint64 target = (Uint64)ceil(p*st->count);
+    if(target<1) target=1;
+    Uint64 acc = 0;
+    for(int b=0;b<HIST_BUCKETS;b++){
+        acc += st->hist[b];
+        if(acc>=target){
+            double ms = ldexp(1.0 + (b%HIST_SUB + 0.5)/HIST_SUB, b/HIST_SUB)/1000.0;
+            return ms < st->maxMs ? ms : st->maxMs;
+        }
+    }
+    return st->maxMs;
+}
+
+// Tabla en consola y archivos <prefijo>.csv / <prefijo>.json
+void dumpStageStats(const char* prefix, int frames){
+    char path[256];
+    snprintf(path, sizeof(path), "%s.csv", prefix);
+    FILE* csv = fopen(path, "w");
+    snprintf(path, sizeof(path), "%s.json", prefix);
+    FILE* json = fopen(path, "w");
+
+    if(csv) fprintf(csv, "etapa,muestras,media_ms,p50_ms,p95_ms,p99_ms,max_ms\n");
+    if(json) fprintf(json, "{\n  \"frames\": %d,\n  \"etapas\": [\n", frames);
+    printf("%-15s %9s %9s %9s %9s %9s %9s\n", "etapa", "muestras", "media", "p50", "p95", "p99", "max");
+
+    for(int s=0;s<NUM_STAGES;s++){
+        const StageStats* st = &stageStats[s];
+        unsigned long long n = (unsigned long long)st->count;
+        double mean = st->count ? st->totalMs/st->count : 0.0;
+        double p50 = stagePercentile(st, 0.50);
+        double p95 = stagePercentile(st, 0.95);
+        double p99 = stagePercentile(st, 0.99);
+
+        printf("%-15s %9llu %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+               stageNames[s], n, mean, p50, p95, p99, st->maxMs);
+        if(csv) fprintf(csv, "%s,%llu,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+                        stageNames[s], n, mean, p50, p95, p99, st->maxMs);
+        if(json) fprintf(json, "    {\"etapa\": \"%s\", \"muestras\": %llu, \"media_ms\": %.4f, "
+                         "\"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f}%s\n",
+                         stageNames[s], n, mean, p50, p95, p99, st->maxMs, s+1<NUM_STAGES ? "," : "");
+    }
+
+    if(json) fprintf(json, "  ]\n}\n");
+    if(csv) fclose(csv);
+    if(json) fclose(json);
+}
+
 // Calculo de la altura de onda
 float waveHeight(float x,float z,float t){
     return waveAmplitude*(
@@ -42,38 +273,401 @@ float waveHeight(float x,float z,float t){
     );
 }
 
-// Proyección de los puntos 3D en 2D
-void project3D(float camX,float camY,float camZ,float lookX,float lookY,float lookZ,
-               float x,float y,float z,float *sx,float *sy,float *depth) {
-    // Posición de la camara en (0,0,0)
-    float rx = x - camX;
-    float ry = y - camY;
-    float rz = z - camZ;
+// Aproximaciones de sin/cos vectorizables (sin llamadas a libm) para evaluar la ola en lote.
+// Se reduce el argumento a r en [-pi/2, pi/2] restando k*pi en dos partes (Cody-Waite) y se
+// evalúa un polinomio minimax impar de grado 9. Error absoluto máximo medido frente a sin()
+// y cos() en double: 2e-7 para |x| <= 8192 (t llega ahí tras ~45 min a 60 FPS). Para |x| mayor
+// la reducción pierde precisión, igual que el propio argumento en float.
+#define FAST_PI_A 3.140625f
+#define FAST_PI_B 9.67653589793e-4f
+#define FAST_INV_PI 0.31830988618f
+
+static inline float fastSinPoly(float r){
+    float r2 = r*r;
+    return r*(0.99999997661f + r2*(-0.16666647643f + r2*(0.0083328999361f +
+             r2*(-0.00019800903682f + r2*2.5904989073e-6f))));
+}
+
+// floor con conversión a entero (floorf no se vectoriza sin -ffast-math)
+static inline int fastFloorInt(float v){
+    int i = (int)v;
+    return i - (v < (float)i);
+}
+
+// sin(x) = (-1)^k sin(x - k*pi)
+static inline float fastSinf(float x){
+    int ki = fastFloorInt(x*FAST_INV_PI + 0.5f);
+    float k = (float)ki;
+    float r = (x - k*FAST_PI_A) - k*FAST_PI_B;
+    float sign = 1.0f - 2.0f*(float)(ki & 1);
+    return sign*fastSinPoly(r);
+}
+
+// cos(x) = -(-1)^k sin(x - (k+1/2)*pi)
+static inline float fastCosf(float x){
+    int ki = fastFloorInt(x*FAST_INV_PI);
+    float q = (float)ki + 0.5f;
+    float r = (x - q*FAST_PI_A) - q*FAST_PI_B;
+    float sign = 2.0f*(float)(ki & 1) - 1.0f;
+    return sign*fastSinPoly(r);
+}
+
+// Altura de la ola para n puntos (x[k], z[k]); out puede ser uno de los arreglos de entrada
+void waveHeightBatch(const float* x, const float* z, float* out, int n, float t){
+    float fx = 0.3f*waveFrequency;
+    float fz = 0.4f*waveFrequency;
+    float fxz = 0.2f*waveFrequency;
+    float amp = waveAmplitude;
+    #pragma omp simd
+    for(int k=0;k<n;k++){
+        out[k] = amp*(
+            1.5f*fastSinf(fx*x[k] + t) +
+            1.0f*fastCosf(fz*z[k] + 0.5f*t) +
+            0.7f*fastSinf(fxz*(x[k]+z[k]) + 0.8f*t)
+        );
+    }
+}
+
+// Estado persistente del terreno: se reserva solo cuando cambia gridSize. Alturas, normales y
+// colores van en doble buffer: el render dibuja el actual mientras el hilo de física arma el
+// siguiente para la instantánea que está calculando
+typedef struct {
+    int size;               // vértices por lado
+    float* heights[2];      // alturas actual / siguiente
+    float* normals[2];      // normal de cada cuadro (3 floats), (size-1)^2 cuadros
+    Uint32* quadColors[2];  // color de cada cuadro
+    int current;            // índice del buffer actual
+    float* phase;           // tablas de fase de la ola (4*size)
+} Terrain;
+
+Terrain terrain = {0};
+
+void freeTerrain(Terrain* tr){
+    for(int b = 0; b < 2; b++){
+        free(tr->heights[b]);
+        free(tr->normals[b]);
+        free(tr->quadColors[b]);
+    }
+    free(tr->phase);
+    *tr = (Terrain){0};
+}
+
+// Reservar buffers del terreno si cambió el tamaño de la malla
+void ensureTerrain(Terrain* tr, int size){
+    if(tr->size == size) return;
+    freeTerrain(tr);
+    int quads = (size - 1) * (size - 1);
+    tr->size = size;
+    for(int b = 0; b < 2; b++){
+        tr->heights[b] = malloc(size * size * sizeof(float));
+        tr->normals[b] = malloc(3 * quads * sizeof(float));
+        tr->quadColors[b] = malloc(quads * sizeof(Uint32));
+    }
+    tr->phase = malloc(4 * size * sizeof(float));
+}
+
+static inline const float* terrainHeights(const Terrain* tr){
+    return tr->heights[tr->current];
+}
+
+static inline const Uint32* terrainColors(const Terrain* tr){
+    return tr->quadColors[tr->current];
+}
+
+static inline float* terrainNextHeights(Terrain* tr){
+    return tr->heights[1 - tr->current];
+}
+
+// Publicar el buffer siguiente como actual; solo con la física esperando un pedido
+static inline void swapTerrain(Terrain* tr){
+    tr->current = 1 - tr->current;
+}
+
+// Alturas de la malla en el buffer siguiente: cada término de la ola depende solo de i,
+// de j o de i+j, así que bastan 4*size senos por frame y el resto son sumas
+void buildTerrainHeights(Terrain* tr, float t){
+    int size = tr->size;
+    float* heights = terrainNextHeights(tr);
+    float* rowTerm = tr->phase;                // sin(a*x + t), x = i*SCALE
+    float* colTerm = tr->phase + size;         // cos(b*z + 0.5t), z = j*SCALE
+    float* diagTerm = tr->phase + 2*size;      // sin(c*(x+z) + 0.8t), i+j en [0, 2*size-2]
+
+    for(int i = 0; i < size; i++) {
+        rowTerm[i] = waveAmplitude * 1.5f * sinf(0.3f * (i * SCALE) * waveFrequency + t);
+        colTerm[i] = waveAmplitude * 1.0f * cosf(0.4f * (i * SCALE) * waveFrequency + 0.5f * t);
+    }
+    for(int k = 0; k < 2*size - 1; k++) {
+        diagTerm[k] = waveAmplitude * 0.7f * sinf(0.2f * (k * SCALE) * waveFrequency + 0.8f * t);
+    }
+
+    #pragma omp parallel for schedule(static)
+    for(int i = 0; i < size; i++) {
+        float a = rowTerm[i];
+        const float* diag = diagTerm + i;
+        float* row = heights + i * size;
+        #pragma omp simd
+        for(int j = 0; j < size; j++) {
+            row[j] = a + colTerm[j] + diag[j];
+        }
+    }
+}
+
+// Normales e iluminación difusa de cada cuadro del buffer siguiente
+void shadeTerrain(Terrain* tr, float t, float lightX, float lightY, float lightZ){
+    int size = tr->size;
+    const float* h = terrainNextHeights(tr);
+    float* normals = tr->normals[1 - tr->current];
+    Uint32* quadColors = tr->quadColors[1 - tr->current];
+
+    #pragma omp parallel for schedule(static)
+    for (int i = 0; i < size - 1; i++) {
+        for (int j = 0; j < size - 1; j++) {
+            int q = i * (size - 1) + j;
+            float y0 = h[i * size + j];
+            float y1 = h[(i + 1) * size + j];
+            float y2 = h[i * size + (j + 1)];
+            float y3 = h[(i + 1) * size + (j + 1)];
+
+            // calcular normales para iluminación
+            float hL = (i > 0) ? h[(i - 1) * size + j] : y0;
+            float hR = (i < size - 2) ? h[(i + 2) * size + j] : y1;
+            float hD = (j > 0) ? h[i * size + (j - 1)] : y0;
+            float hU = (j < size - 2) ? h[i * size + (j + 2)] : y2;
+
+            float nx = hL - hR, ny = 2.0f, nz = hD - hU;
+            float len = sqrtf(nx * nx + ny * ny + nz * nz);
+            if (len > 0.0f) {
+                nx /= len; ny /= len; nz /= len;
+            }
+            normals[3*q] = nx;
+            normals[3*q + 1] = ny;
+            normals[3*q + 2] = nz;
+
+            // iluminación difusa desde el centro del cuadro
+            float centerX = (i + 0.5f) * SCALE;
+            float centerY = (y0 + y1 + y2 + y3) * 0.25f;
+            float centerZ = (j + 0.5f) * SCALE;
+            float lx = lightX - centerX, ly = lightY - centerY, lz = lightZ - centerZ;
+            float llen = sqrtf(lx * lx + ly * ly + lz * lz);
+            lx /= llen; ly /= llen; lz /= llen;
+
+            float diff = fmaxf(0.0f, nx * lx + ny * ly + nz * lz);
+            float wave = 0.5f + 0.5f * sinf(t * 0.3f + (i + j) * 0.05f);
+
+            Uint8 r = 10;
+            Uint8 g = (Uint8)((50 + 150 * diff) * wave);
+            Uint8 b = (Uint8)((100 + 100 * diff) * (1 - 0.3f * wave));
+            quadColors[q] = (r << 16) | (g << 8) | b;
+        }
+    }
+}
+
+// Cámara del frame: base de vista y matriz vista-proyección 4x4 (fila mayor).
+// clip = viewProj * (x,y,z,1); pantalla = (clip.x/clip.w, clip.y/clip.w), profundidad = clip.w
+#define CAMERA_FOCAL 500.0f   // distancia focal en pixeles
+#define CAMERA_NEAR 0.1f
+
+// Bits de recorte de un punto contra el volumen de vista (pantalla completa, w >= CAMERA_NEAR).
+// Cada bit es un semiespacio del mundo, así que si todos los vértices de una primitiva
+// comparten un bit, la primitiva completa queda fuera de la vista.
+#define CLIP_NEAR   1
+#define CLIP_LEFT   2
+#define CLIP_RIGHT  4
+#define CLIP_TOP    8
+#define CLIP_BOTTOM 16
+
+typedef struct {
+    float x, y, z;              // posición
+    float lookX, lookY, lookZ;  // dirección de la vista (sin normalizar)
+    float right[3], up[3], forward[3];
+    float viewProj[16];
+} Camera;
+
+Camera camera;
+
+// Construir la base (con inclinación) y la matriz vista-proyección a partir de posición y dirección
+void setCameraLookAt(Camera* cam, float camX, float camY, float camZ,
+                     float lookX, float lookY, float lookZ){
+    cam->x = camX; cam->y = camY; cam->z = camZ;
+    cam->lookX = lookX; cam->lookY = lookY; cam->lookZ = lookZ;
+
+    float flen = sqrtf(lookX*lookX + lookY*lookY + lookZ*lookZ);
+    float f[3] = { lookX/flen, lookY/flen, lookZ/flen };
+
+    // derecha horizontal; si se mira en vertical se usa el eje x
+    float hlen = sqrtf(lookX*lookX + lookZ*lookZ);
+    float r[3] = { 1.0f, 0.0f, 0.0f };
+    if(hlen > 1e-6f){ r[0] = lookZ/hlen; r[2] = -lookX/hlen; }
+
+    // arriba = adelante x derecha
+    float u[3] = { f[1]*r[2] - f[2]*r[1], f[2]*r[0] - f[0]*r[2], f[0]*r[1] - f[1]*r[0] };
+
+    for(int k=0;k<3;k++){ cam->right[k] = r[k]; cam->up[k] = u[k]; cam->forward[k] = f[k]; }
+
+    float cx = (float)(windowWidth/2), cy = (float)(windowHeight/2);
+    float tr = -(r[0]*camX + r[1]*camY + r[2]*camZ);
+    float tu = -(u[0]*camX + u[1]*camY + u[2]*camZ);
+    float tf = -(f[0]*camX + f[1]*camY + f[2]*camZ);
+    float* m = cam->viewProj;
+    for(int k=0;k<3;k++){
+        m[k]      = CAMERA_FOCAL*r[k] + cx*f[k];
+        m[4 + k]  = -CAMERA_FOCAL*u[k] + cy*f[k];
+        m[8 + k]  = f[k];
+        m[12 + k] = f[k];
+    }
+    m[3]  = CAMERA_FOCAL*tr + cx*tf;
+    m[7]  = -CAMERA_FOCAL*tu + cy*tf;
+    m[11] = tf;
+    m[15] = tf;
+}
+
+// Proyección en lote de n puntos (arreglos SoA), con sus bits de recorte
+void projectPoints(const Camera* cam, const float* x, const float* y, const float* z, int n,
+                   float* sx, float* sy, float* depth, Uint8* outcode){
+    const float* m = cam->viewProj;
+    float hx = (float)(windowWidth/2), hy = (float)(windowHeight/2);
+    float width = (float)windowWidth, height = (float)windowHeight;
+    #pragma omp simd
+    for(int k=0;k<n;k++){
+        float cx = m[0]*x[k] + m[1]*y[k] + m[2]*z[k] + m[3];
+        float cy = m[4]*x[k] + m[5]*y[k] + m[6]*z[k] + m[7];
+        float w = m[12]*x[k] + m[13]*y[k] + m[14]*z[k] + m[15];
+        outcode[k] = (Uint8)((w < CAMERA_NEAR ? CLIP_NEAR : 0) |
+                             (cx < 0.0f ? CLIP_LEFT : 0) | (cx > width*w ? CLIP_RIGHT : 0) |
+                             (cy < 0.0f ? CLIP_TOP : 0) | (cy > height*w ? CLIP_BOTTOM : 0));
+        // lo que queda detrás del plano cercano se pega a él (esas primitivas se recortan aparte)
+        float wc = fmaxf(w, CAMERA_NEAR);
+        sx[k] = (cx + hx*(wc - w)) / wc;
+        sy[k] = (cy + hy*(wc - w)) / wc;
+        depth[k] = wc;
+    }
+}
 
-    // Vectores de dirección punto -> camara
-    float lx = lookX - camX;
-    float lz = lookZ - camZ;
+// Coordenadas de recorte (cx, cy, w) de un punto, sin dividir
+static inline void clipPoint(const Camera* cam, float x, float y, float z, float out[3]){
+    const float* m = cam->viewProj;
+    out[0] = m[0]*x + m[1]*y + m[2]*z + m[3];
+    out[1] = m[4]*x + m[5]*y + m[6]*z + m[7];
+    out[2] = m[12]*x + m[13]*y + m[14]*z + m[15];
+}
 
-    // Angulo de movimiento hacia la vista de camara
-    float angle = atan2f(lx,lz);
-    float ca = cosf(angle);
-    float sa = sinf(angle);
-    float tx = ca*rx - sa*rz;
-    float tz = sa*rx + ca*rz;
-    float ty = ry;
+// Recortar un triángulo en coordenadas de recorte contra el plano w = CAMERA_NEAR
+// (Sutherland-Hodgman). Deja el polígono resultante (0, 3 o 4 vértices) ya proyectado
+// y devuelve cuántos vértices tiene; se dibuja como abanico desde el vértice 0.
+int clipTriangleNear(const float in[3][3], float* sx, float* sy, float* depth){
+    int n = 0;
+    for(int a = 0; a < 3; a++){
+        const float* p = in[a];
+        const float* q = in[(a + 1) % 3];
+        int pIn = p[2] >= CAMERA_NEAR, qIn = q[2] >= CAMERA_NEAR;
+        if(pIn){
+            sx[n] = p[0] / p[2]; sy[n] = p[1] / p[2]; depth[n] = p[2];
+            n++;
+        }
+        if(pIn != qIn){
+            // punto de la arista sobre el plano cercano
+            float s = (CAMERA_NEAR - p[2]) / (q[2] - p[2]);
+            sx[n] = (p[0] + s*(q[0] - p[0])) / CAMERA_NEAR;
+            sy[n] = (p[1] + s*(q[1] - p[1])) / CAMERA_NEAR;
+            depth[n] = CAMERA_NEAR;
+            n++;
+        }
+    }
+    return n;
+}
 
-    // Proyección 2D
-    float fov = 500.0f;
-    if(tz <= 0.1f) tz = 0.1f;
-    *sx = windowWidth/2 + tx * fov / tz;
-    *sy = windowHeight/2 - ty * fov / tz;
-    *depth = tz;
+// Vértices del terreno y centros de esferas proyectados una vez por frame
+typedef struct {
+    int terrainCapacity, sphereCapacity;
+    float *terrainX, *terrainY, *terrainDepth;
+    float *sphereX, *sphereY, *sphereDepth;
+    float *sphereWX, *sphereWY, *sphereWZ;  // posición interpolada entre pasos de física
+    Uint8 *terrainOut, *sphereOut;      // bits de recorte (CLIP_*)
+} ProjectedScene;
+
+ProjectedScene projected = {0};
+
+void freeProjectedScene(ProjectedScene* ps){
+    free(ps->terrainX); free(ps->terrainY); free(ps->terrainDepth);
+    free(ps->sphereX); free(ps->sphereY); free(ps->sphereDepth);
+    free(ps->sphereWX); free(ps->sphereWY); free(ps->sphereWZ);
+    free(ps->terrainOut); free(ps->sphereOut);
+    *ps = (ProjectedScene){0};
+}
+
+// Proyectar la malla del terreno y las esferas con la cámara del frame
+void projectScene(ProjectedScene* ps, const Camera* cam, const Terrain* tr){
+    int nv = tr->size * tr->size;
+    if(nv > ps->terrainCapacity){
+        free(ps->terrainX); free(ps->terrainY); free(ps->terrainDepth); free(ps->terrainOut);
+        ps->terrainX = malloc(nv * sizeof(float));
+        ps->terrainY = malloc(nv * sizeof(float));
+        ps->terrainDepth = malloc(nv * sizeof(float));
+        ps->terrainOut = malloc(nv * sizeof(Uint8));
+        ps->terrainCapacity = nv;
+    }
+    if(numSpheres > ps->sphereCapacity){
+        free(ps->sphereX); free(ps->sphereY); free(ps->sphereDepth); free(ps->sphereOut);
+        free(ps->sphereWX); free(ps->sphereWY); free(ps->sphereWZ);
+        ps->sphereWX = malloc(numSpheres * sizeof(float));
+        ps->sphereWY = malloc(numSpheres * sizeof(float));
+        ps->sphereWZ = malloc(numSpheres * sizeof(float));
+        ps->sphereX = malloc(numSpheres * sizeof(float));
+        ps->sphereY = malloc(numSpheres * sizeof(float));
+        ps->sphereDepth = malloc(numSpheres * sizeof(float));
+        ps->sphereOut = malloc(numSpheres * sizeof(Uint8));
+        ps->sphereCapacity = numSpheres;
+    }
+
+    // terreno por filas: x constante, z = j*SCALE
+    const float* heights = terrainHeights(tr);
+    int size = tr->size;
+    #pragma omp parallel for schedule(static)
+    for(int i = 0; i < size; i++){
+        float xs[PHYSICS_BLOCK], zs[PHYSICS_BLOCK];
+        for(int j0 = 0; j0 < size; j0 += PHYSICS_BLOCK){
+            int n = size - j0 < PHYSICS_BLOCK ? size - j0 : PHYSICS_BLOCK;
+            for(int k = 0; k < n; k++){
+                xs[k] = i * SCALE;
+                zs[k] = (j0 + k) * SCALE;
+            }
+            int v = i * size + j0;
+            projectPoints(cam, xs, &heights[v], zs, n,
+                          &ps->terrainX[v], &ps->terrainY[v], &ps->terrainDepth[v],
+                          &ps->terrainOut[v]);
+        }
+    }
+
+    const SphereSnapshot* sn = drawSpheres;
+    int numActive = sn->count;
+    int numBlocks = (numActive + PHYSICS_BLOCK - 1) / PHYSICS_BLOCK;
+    #pragma omp parallel for schedule(static)
+    for(int blk = 0; blk < numBlocks; blk++){
+        int begin = blk * PHYSICS_BLOCK;
+        int n = numActive - begin < PHYSICS_BLOCK ? numActive - begin : PHYSICS_BLOCK;
+        float a = sn->alpha;
+        for(int i = begin; i < begin + n; i++){
+            ps->sphereWX[i] = sn->prevX[i] + a*(sn->x[i] - sn->prevX[i]);
+            ps->sphereWY[i] = sn->prevY[i] + a*(sn->y[i] - sn->prevY[i]);
+            ps->sphereWZ[i] = sn->prevZ[i] + a*(sn->z[i] - sn->prevZ[i]);
+        }
+        projectPoints(cam, &ps->sphereWX[begin], &ps->sphereWY[begin], &ps->sphereWZ[begin], n,
+                      &ps->sphereX[begin], &ps->sphereY[begin], &ps->sphereDepth[begin],
+                      &ps->sphereOut[begin]);
+    }
+}
+
+// Buffers alineados a 64 bytes: framebuffer y z-buffer quedan con el mismo desfase
+// en cada pixel, así la limpieza vectorial avanza los dos a la vez
+static void* renderArray(size_t bytes){
+    bytes = (bytes + SPHERE_ALIGN - 1) / SPHERE_ALIGN * SPHERE_ALIGN;
+    return aligned_alloc(SPHERE_ALIGN, bytes);
 }
 
 // inicializar buffers
 void initRenderBuffers() {
-    frameBuffer = malloc(windowWidth * windowHeight * sizeof(Uint32));
-    zbuffer = malloc(windowWidth * windowHeight * sizeof(float));
+    frameBuffer = renderArray((size_t)windowWidth * windowHeight * sizeof(Uint32));
+    zbuffer = renderArray((size_t)windowWidth * windowHeight * sizeof(float));
 }
 
 // liberar buffers
@@ -82,6 +676,61 @@ void freeRenderBuffers() {
     if(zbuffer) { free(zbuffer); zbuffer = NULL; }
 }
 
+// Limpia n pixeles de color y profundidad. Con streaming=1 usa stores no temporales,
+// que no pasan por la caché (para limpiar el frame entero; requiere streamFence() al final).
+// Con streaming=0 son stores normales y el bloque queda en caché para dibujarlo enseguida.
+static inline void clearSpan(Uint32* color, float* depth, int n, int streaming){
+    int i = 0;
+#if defined(__AVX2__) || defined(__AVX512F__)
+    if(streaming){
+        for(; i < n && ((uintptr_t)(color + i) & 31); i++){ color[i] = 0; depth[i] = DEPTH_CLEAR; }
+        __m256i zero = _mm256_setzero_si256();
+        __m256 far = _mm256_set1_ps(DEPTH_CLEAR);
+        for(; i + 8 <= n; i += 8){
+            _mm256_stream_si256((__m256i*)(color + i), zero);
+            _mm256_stream_ps(depth + i, far);
+        }
+    }
+#elif defined(__SSE2__)
+    if(streaming){
+        for(; i < n && ((uintptr_t)(color + i) & 15); i++){ color[i] = 0; depth[i] = DEPTH_CLEAR; }
+        __m128i zero = _mm_setzero_si128();
+        __m128 far = _mm_set1_ps(DEPTH_CLEAR);
+        for(; i + 4 <= n; i += 4){
+            _mm_stream_si128((__m128i*)(color + i), zero);
+            _mm_stream_ps(depth + i, far);
+        }
+    }
+#endif
+    for(; i < n; i++){
+        color[i] = 0;
+        depth[i] = DEPTH_CLEAR;
+    }
+}
+
+// ordena los stores no temporales antes de que otro hilo lea el buffer
+static inline void streamFence(void){
+#if defined(__SSE2__)
+    _mm_sfence();
+#endif
+}
+
+// Limpieza completa con stores no temporales, un bloque contiguo por hilo.
+// El render por tiles no la necesita (limpia cada tile antes de dibujarlo).
+void clearRenderBuffers() {
+    int n = windowWidth * windowHeight;
+    #pragma omp parallel
+    {
+        // bloques múltiplo de 16 pixeles (64 bytes) para no partir líneas de caché
+        int threads = omp_get_num_threads();
+        int chunk = ((n + threads - 1) / threads + 15) & ~15;
+        int start = omp_get_thread_num() * chunk;
+        int end = start + chunk < n ? start + chunk : n;
+        if(start < end) clearSpan(frameBuffer + start, zbuffer + start, end - start, 1);
+        streamFence();
+    }
+}
+
 // Manejar el cambio de tamaño de la ventana
 void resizeRenderBuffers(SDL_Renderer* renderer) {
     // Liberar buffers antiguos
@@ -98,408 +747,2060 @@ void resizeRenderBuffers(SDL_Renderer* renderer) {
     
     // Recrear buffers con nuevo tamaño
     initRenderBuffers();
+    clearRenderBuffers();
+}
+
+
+// Coordenada entera de celda
+static inline int cellCoord(float v, float cellSize){
+    return (int)floorf(v / cellSize);
+}
+
+// Hash de una celda 3D a una cubeta de la tabla
+static inline int cellHash(int cx, int cy, int cz, int tableSize){
+    unsigned int h = ((unsigned int)cx * 73856093u) ^
+                     ((unsigned int)cy * 19349663u) ^
+                     ((unsigned int)cz * 83492791u);
+    return (int)(h & (unsigned int)(tableSize - 1));
+}
+
+// Reservar memoria del grid solo cuando cambia el número de esferas
+void ensureGridCapacity(int n){
+    if(n <= grid.capacity) return;
+
+    int tableSize = 1;
+    while(tableSize < 2*n) tableSize <<= 1;
+
+    free(grid.cellStart);
+    free(grid.sortedIdx);
+    free(grid.sphereCell);
+    grid.cellStart = malloc((tableSize + 1) * sizeof(int));
+    grid.sortedIdx = malloc(n * sizeof(int));
+    grid.sphereCell = malloc(n * sizeof(int));
+    free(collisionBuf);
+    collisionBuf = malloc(n * sizeof(CollisionBuffer));
+    grid.tableSize = tableSize;
+    grid.capacity = n;
+}
+
+void freeGrid(){
+    free(grid.cellStart);
+    free(grid.sortedIdx);
+    free(grid.sphereCell);
+    free(collisionBuf);
+    collisionBuf = NULL;
+    free(sleepScratch);
+    sleepScratch = NULL;
+    sleepScratchCapacity = 0;
+    free(stepDeps);
+    stepDeps = NULL;
+    stepDepsCapacity = 0;
+    grid = (SpatialGrid){0};
+}
+
+// Reservar el barrido para todas las esferas; ids arranca con la identidad y se ordena
+// completo la primera vez
+void ensureSweepCapacity(int n){
+    if(n <= sweep.capacity) return;
+
+    free(sweep.ids);
+    free(sweep.keys);
+    free(sweep.slots);
+    free(sweep.xs);
+    free(sweep.rankOf);
+    sweep.ids = malloc(n * sizeof(int));
+    sweep.keys = malloc(n * sizeof(float));
+    sweep.slots = malloc(n * sizeof(int));
+    sweep.xs = malloc(n * sizeof(float));
+    sweep.rankOf = malloc(n * sizeof(int));
+    for(int k=0;k<n;k++) sweep.ids[k] = k;
+    sweep.capacity = n;
+    sweep.sorted = 0;
+}
+
+void freeSweep(){
+    free(sweep.ids);
+    free(sweep.keys);
+    free(sweep.slots);
+    free(sweep.xs);
+    free(sweep.rankOf);
+    sweep = (SweepAndPrune){0};
+}
+
+// Reservar la caché de contactos; una esfera nueva arranca sin pares
+void ensureContactCapacity(int n){
+    if(n <= contacts.capacity) return;
+
+    free(contacts.other); free(contacts.lambda); free(contacts.count);
+    free(contacts.stepSlot); free(contacts.stepLambda); free(contacts.stepCount);
+    contacts.other = malloc((size_t)n * MAX_CONTACTS * sizeof(int));
+    contacts.lambda = malloc((size_t)n * MAX_CONTACTS * sizeof(float));
+    contacts.count = calloc(n, sizeof(Uint8));
+    contacts.stepSlot = malloc((size_t)n * MAX_CONTACTS * sizeof(int));
+    contacts.stepLambda = malloc((size_t)n * MAX_CONTACTS * sizeof(float));
+    contacts.stepCount = calloc(n, sizeof(Uint8));
+    contacts.capacity = n;
+}
+
+void freeContacts(){
+    free(contacts.other); free(contacts.lambda); free(contacts.count);
+    free(contacts.stepSlot); free(contacts.stepLambda); free(contacts.stepCount);
+    contacts = (ContactCache){0};
+}
+
+// Preparar la fase amplia para m esferas: capacidad y radio máximo; el lado de la celda es
+// el tamaño de la malla del terreno, o el diámetro más el margen de contacto si es mayor
+// (así los pares de la caché caen siempre en celdas vecinas)
+void prepareBroadphase(int m){
+    ensureGridCapacity(numSpheres);
+    if(broadphase == BROADPHASE_SAP) ensureSweepCapacity(numSpheres);
+    float maxRadius = 0.0f;
+    for(int i=0;i<m;i++){
+        if(spheres.radius[i] > maxRadius) maxRadius = spheres.radius[i];
+    }
+    broadphaseMaxRadius = maxRadius;
+    grid.cellSize = fmaxf(SCALE, 2.0f*maxRadius + CONTACT_MARGIN);
+
+    // el barrido va por el eje donde las esferas están más repartidas; se cambia solo con un
+    // margen claro porque cambiar de eje obliga a reordenar todo
+    if(broadphase == BROADPHASE_SAP && m > 0){
+        float minX = spheres.x[0], maxX = spheres.x[0], minZ = spheres.z[0], maxZ = spheres.z[0];
+        for(int i=1;i<m;i++){
+            minX = fminf(minX, spheres.x[i]); maxX = fmaxf(maxX, spheres.x[i]);
+            minZ = fminf(minZ, spheres.z[i]); maxZ = fmaxf(maxZ, spheres.z[i]);
+        }
+        float spread[2] = { maxX - minX, maxZ - minZ };
+        int other = 1 - sweep.axis;
+        if(spread[other] > 1.25f*spread[sweep.axis]){
+            sweep.axis = other;
+            sweep.sorted = 0;
+        }
+    }
+}
+
+// Cubeta de cada esfera de [begin,end); se llama por bloque, con los datos recién integrados
+static inline void hashGridRange(int begin, int end){
+    for(int i=begin;i<end;i++){
+        grid.sphereCell[i] = cellHash(cellCoord(spheres.x[i], grid.cellSize),
+                                      cellCoord(spheres.y[i], grid.cellSize),
+                                      cellCoord(spheres.z[i], grid.cellSize),
+                                      grid.tableSize);
+    }
+}
+
+// Counting sort de las m esferas por cubeta (secuencial para que el orden sea determinista)
+void sortGrid(int m){
+    memset(grid.cellStart, 0, (grid.tableSize + 1) * sizeof(int));
+    for(int i=0;i<m;i++){
+        grid.cellStart[grid.sphereCell[i] + 1]++;
+    }
+    for(int c=0;c<grid.tableSize;c++){
+        grid.cellStart[c+1] += grid.cellStart[c];
+    }
+
+    // repartir índices; cellStart[c] avanza y al final queda en el inicio de c+1
+    for(int i=0;i<m;i++){
+        grid.sortedIdx[grid.cellStart[grid.sphereCell[i]]++] = i;
+    }
+    for(int c=grid.tableSize; c>0; c--){
+        grid.cellStart[c] = grid.cellStart[c-1];
+    }
+    grid.cellStart[0] = 0;
+}
+
+static inline const float* sweepAxis(){
+    return sweep.axis ? spheres.z : spheres.x;
+}
+
+static int compareSweepKeys(const void* a, const void* b){
+    int ia = *(const int*)a, ib = *(const int*)b;
+    const float *axis = sweepAxis();
+    float xa = axis[spheres.slotOf[ia]], xb = axis[spheres.slotOf[ib]];
+    if(xa != xb) return xa < xb ? -1 : 1;
+    return ia - ib;   // empate por id para que el orden no dependa de qsort
+}
+
+// Ordenar por el eje del barrido. Entre pasos las esferas se mueven poco, así que una inserción sobre el orden
+// anterior es casi lineal; solo la primera vez se ordena con qsort. Las inactivas quedan en la
+// lista (no se mueven) y se saltan al armar el arreglo compacto del paso
+void sortSweep(int m){
+    int total = sweep.capacity;
+    if(!sweep.sorted){
+        qsort(sweep.ids, total, sizeof(int), compareSweepKeys);
+        sweep.sorted = 1;
+    }
+    const float *axis = sweepAxis();
+    for(int k=0;k<total;k++) sweep.keys[k] = axis[spheres.slotOf[sweep.ids[k]]];
+
+    for(int k=1;k<total;k++){
+        float key = sweep.keys[k];
+        int id = sweep.ids[k];
+        int p = k - 1;
+        while(p >= 0 && (sweep.keys[p] > key || (sweep.keys[p] == key && sweep.ids[p] > id))){
+            sweep.keys[p+1] = sweep.keys[p];
+            sweep.ids[p+1] = sweep.ids[p];
+            p--;
+        }
+        sweep.keys[p+1] = key;
+        sweep.ids[p+1] = id;
+    }
+
+    int count = 0;
+    for(int k=0;k<total;k++){
+        int s = spheres.slotOf[sweep.ids[k]];
+        if(s >= m) continue;
+        sweep.slots[count] = s;
+        sweep.xs[count] = sweep.keys[k];
+        sweep.rankOf[s] = count;
+        count++;
+    }
+    sweep.count = count;
+}
+
+// Cubetas distintas de la celda de la esfera y sus 26 vecinas
+static int neighbourBuckets(int i, int *buckets){
+    int cx = cellCoord(spheres.x[i], grid.cellSize);
+    int cy = cellCoord(spheres.y[i], grid.cellSize);
+    int cz = cellCoord(spheres.z[i], grid.cellSize);
+    int count = 0;
+
+    for(int ox=-1; ox<=1; ox++){
+        for(int oy=-1; oy<=1; oy++){
+            for(int oz=-1; oz<=1; oz++){
+                int b = cellHash(cx+ox, cy+oy, cz+oz, grid.tableSize);
+
+                // dos celdas pueden caer en la misma cubeta, visitarla una sola vez
+                int seen = 0;
+                for(int k=0;k<count;k++){
+                    if(buckets[k] == b){ seen = 1; break; }
+                }
+                if(!seen) buckets[count++] = b;
+            }
+        }
+    }
+    return count;
+}
+
+// Candidatos de la fase amplia para la esfera i a distancia de contacto más extra: rangos
+// [begin,end) de *list. Con el grid son las cubetas vecinas; con el barrido, el único tramo
+// de la lista ordenada cuyo centro cae a menos de r_i + radio máximo + extra sobre el eje
+static int broadphaseRanges(int i, float extra, const int **list, int *begin, int *end){
+    if(broadphase == BROADPHASE_SAP){
+        float x = sweepAxis()[i];
+        float reach = spheres.radius[i] + broadphaseMaxRadius + extra;
+        int p = sweep.rankOf[i];
+        int lo = p, hi = p + 1;
+        while(lo > 0 && x - sweep.xs[lo-1] < reach) lo--;
+        while(hi < sweep.count && sweep.xs[hi] - x < reach) hi++;
+        *list = sweep.slots;
+        begin[0] = lo;
+        end[0] = hi;
+        return 1;
+    }
+
+    int buckets[27];
+    int nb = neighbourBuckets(i, buckets);
+    *list = grid.sortedIdx;
+    for(int b=0;b<nb;b++){
+        begin[b] = grid.cellStart[buckets[b]];
+        end[b] = grid.cellStart[buckets[b] + 1];
+    }
+    return nb;
+}
+
+// Reservar un arreglo alineado para la SoA de esferas
+static void* sphereArray(int capacity, size_t elemSize){
+    size_t bytes = (size_t)capacity * elemSize;
+    bytes = (bytes + SPHERE_ALIGN - 1) / SPHERE_ALIGN * SPHERE_ALIGN;
+    void* p = aligned_alloc(SPHERE_ALIGN, bytes);
+    memset(p, 0, bytes);
+    return p;
+}
+
+void freeSpheres(){
+    free(spheres.x); free(spheres.y); free(spheres.z);
+    free(spheres.vx); free(spheres.vy); free(spheres.vz);
+    free(spheres.prevX); free(spheres.prevY); free(spheres.prevZ);
+    free(spheres.radius);
+    free(spheres.color);
+    free(spheres.slotOf); free(spheres.idOf);
+    free(spheres.floorY); free(spheres.floorVel);
+    free(spheres.sleepFrames); free(spheres.flip);
+    spheres = (SphereStore){0};
+}
+
+// Reservar el almacenamiento; todas las esferas empiezan inactivas y con slot == id
+void allocSpheres(int n){
+    freeSpheres();
+    int capacity = (n + 15) & ~15;
+    spheres.capacity = capacity;
+    spheres.x = sphereArray(capacity, sizeof(float));
+    spheres.y = sphereArray(capacity, sizeof(float));
+    spheres.z = sphereArray(capacity, sizeof(float));
+    spheres.vx = sphereArray(capacity, sizeof(float));
+    spheres.vy = sphereArray(capacity, sizeof(float));
+    spheres.vz = sphereArray(capacity, sizeof(float));
+    spheres.prevX = sphereArray(capacity, sizeof(float));
+    spheres.prevY = sphereArray(capacity, sizeof(float));
+    spheres.prevZ = sphereArray(capacity, sizeof(float));
+    spheres.radius = sphereArray(capacity, sizeof(float));
+    spheres.color = sphereArray(capacity, sizeof(SphereColor));
+    spheres.floorY = sphereArray(capacity, sizeof(float));
+    spheres.floorVel = sphereArray(capacity, sizeof(float));
+    spheres.sleepFrames = sphereArray(capacity, sizeof(Uint8));
+    spheres.flip = sphereArray(capacity, sizeof(Uint8));
+    spheres.slotOf = malloc(capacity * sizeof(int));
+    spheres.idOf = malloc(capacity * sizeof(int));
+    for(int i=0;i<capacity;i++){
+        spheres.slotOf[i] = i;
+        spheres.idOf[i] = i;
+    }
+    spheres.activeCount = 0;
+    spheres.awakeCount = 0;
+}
+
+// Intercambiar dos posiciones de la SoA manteniendo los mapas id <-> slot
+static void swapSphereSlots(int a, int b){
+    if(a == b) return;
+    float f;
+    f = spheres.x[a]; spheres.x[a] = spheres.x[b]; spheres.x[b] = f;
+    f = spheres.y[a]; spheres.y[a] = spheres.y[b]; spheres.y[b] = f;
+    f = spheres.z[a]; spheres.z[a] = spheres.z[b]; spheres.z[b] = f;
+    f = spheres.vx[a]; spheres.vx[a] = spheres.vx[b]; spheres.vx[b] = f;
+    f = spheres.vy[a]; spheres.vy[a] = spheres.vy[b]; spheres.vy[b] = f;
+    f = spheres.vz[a]; spheres.vz[a] = spheres.vz[b]; spheres.vz[b] = f;
+    f = spheres.prevX[a]; spheres.prevX[a] = spheres.prevX[b]; spheres.prevX[b] = f;
+    f = spheres.prevY[a]; spheres.prevY[a] = spheres.prevY[b]; spheres.prevY[b] = f;
+    f = spheres.prevZ[a]; spheres.prevZ[a] = spheres.prevZ[b]; spheres.prevZ[b] = f;
+    f = spheres.radius[a]; spheres.radius[a] = spheres.radius[b]; spheres.radius[b] = f;
+    SphereColor c = spheres.color[a]; spheres.color[a] = spheres.color[b]; spheres.color[b] = c;
+    f = spheres.floorY[a]; spheres.floorY[a] = spheres.floorY[b]; spheres.floorY[b] = f;
+    f = spheres.floorVel[a]; spheres.floorVel[a] = spheres.floorVel[b]; spheres.floorVel[b] = f;
+    Uint8 u = spheres.sleepFrames[a]; spheres.sleepFrames[a] = spheres.sleepFrames[b]; spheres.sleepFrames[b] = u;
+    u = spheres.flip[a]; spheres.flip[a] = spheres.flip[b]; spheres.flip[b] = u;
+
+    int ida = spheres.idOf[a], idb = spheres.idOf[b];
+    spheres.idOf[a] = idb; spheres.slotOf[idb] = a;
+    spheres.idOf[b] = ida; spheres.slotOf[ida] = b;
+}
+
+// Activar por id: la esfera pasa al final del bloque activo y de ahí al de despiertas, O(1)
+void activateSphere(int id){
+    int slot = spheres.slotOf[id];
+    if(slot < spheres.activeCount) return;
+    swapSphereSlots(slot, spheres.activeCount);
+    swapSphereSlots(spheres.activeCount, spheres.awakeCount);
+    slot = spheres.awakeCount;
+    spheres.sleepFrames[slot] = 0;
+    // sin paso anterior: se dibuja donde está
+    spheres.prevX[slot] = spheres.x[slot];
+    spheres.prevY[slot] = spheres.y[slot];
+    spheres.prevZ[slot] = spheres.z[slot];
+    spheres.activeCount++;
+    spheres.awakeCount++;
+}
+
+// Desactivar por id: la última activa ocupa su lugar, O(1)
+void deactivateSphere(int id){
+    int slot = spheres.slotOf[id];
+    if(slot >= spheres.activeCount) return;
+    if(slot < spheres.awakeCount){
+        // primero al borde de las despiertas para no romper la partición
+        spheres.awakeCount--;
+        swapSphereSlots(slot, spheres.awakeCount);
+        slot = spheres.awakeCount;
+    }
+    spheres.activeCount--;
+    swapSphereSlots(slot, spheres.activeCount);
+}
+
+// Dormir por id: pasa al inicio del bloque de dormidas, sin velocidad horizontal. Sus pares
+// se descartan porque la caché solo se actualiza para las despiertas
+void sleepSphere(int id){
+    int slot = spheres.slotOf[id];
+    if(slot >= spheres.awakeCount) return;
+    spheres.awakeCount--;
+    swapSphereSlots(slot, spheres.awakeCount);
+    slot = spheres.awakeCount;
+    spheres.vx[slot] = 0.0f;
+    spheres.vz[slot] = 0.0f;
+    spheres.sleepFrames[slot] = 0;
+    contacts.count[id] = 0;
+}
+
+// Despertar por id: pasa al final del bloque de despiertas y arranca sin pares
+void wakeSphere(int id){
+    int slot = spheres.slotOf[id];
+    if(slot < spheres.awakeCount || slot >= spheres.activeCount) return;
+    swapSphereSlots(slot, spheres.awakeCount);
+    spheres.sleepFrames[spheres.awakeCount] = 0;
+    spheres.awakeCount++;
+    contacts.count[id] = 0;
+}
+
+// Reordenamiento espacial: cada tantos frames las esferas se ordenan por su clave Morton
+// (curva Z) para que vecinas en el espacio queden vecinas en memoria, tanto para las
+// colisiones como para el reparto de esferas en tiles. Se ordenan por separado las despiertas
+// y las dormidas para no romper la partición; los ids estables no cambian
+typedef struct {
+    int capacity;
+    Uint32 *keys, *keysTmp;     // claves Morton de 30 bits y su buffer del radix sort
+    int *order, *orderTmp;      // slot viejo que va a cada posición nueva
+    void *gather;               // copia temporal de un arreglo permutado
+    int *hist;                  // histograma de cada hilo en una pasada del radix sort
+    int histThreads;
+} SphereReorder;
+
+SphereReorder reorder = {0};
+int reorderFrames = REORDER_FRAMES;
+
+void ensureReorderCapacity(int n){
+    int threads = omp_get_max_threads();
+    if(threads > reorder.histThreads){
+        free(reorder.hist);
+        reorder.hist = malloc(threads * RADIX_BUCKETS * sizeof(int));
+        reorder.histThreads = threads;
+    }
+    if(n <= reorder.capacity) return;
+
+    free(reorder.keys); free(reorder.keysTmp);
+    free(reorder.order); free(reorder.orderTmp);
+    free(reorder.gather);
+    reorder.keys = malloc(n * sizeof(Uint32));
+    reorder.keysTmp = malloc(n * sizeof(Uint32));
+    reorder.order = malloc(n * sizeof(int));
+    reorder.orderTmp = malloc(n * sizeof(int));
+    reorder.gather = sphereArray(n, sizeof(SphereColor));   // el elemento más grande
+    reorder.capacity = n;
+}
+
+void freeReorder(){
+    free(reorder.keys); free(reorder.keysTmp);
+    free(reorder.order); free(reorder.orderTmp);
+    free(reorder.gather);
+    free(reorder.hist);
+    reorder = (SphereReorder){0};
 }
 
+// 10 bits repartidos cada 3 posiciones para intercalar x, y, z
+static inline Uint32 mortonSpread(Uint32 v){
+    v &= 0x3ff;
+    v = (v | (v << 16)) & 0x030000ff;
+    v = (v | (v << 8)) & 0x0300f00f;
+    v = (v | (v << 4)) & 0x030c30c3;
+    v = (v | (v << 2)) & 0x09249249;
+    return v;
+}
+
+// Radix sort LSD estable de keys/order en [begin,end), 8 bits por pasada. Cada hilo cuenta
+// su trozo, los desplazamientos se arman por dígito y luego por hilo y cada hilo reparte
+// su trozo en orden, así el resultado no depende del número de hilos
+static void radixSortRange(int begin, int end){
+    int n = end - begin;
+    if(n < 2) return;
+    Uint32 *keys = reorder.keys + begin, *keysTmp = reorder.keysTmp + begin;
+    int *vals = reorder.order + begin, *valsTmp = reorder.orderTmp + begin;
+
+    // 4 pasadas (par): el resultado queda otra vez en keys/order
+    for(int shift=0; shift<32; shift+=RADIX_BITS){
+        #pragma omp parallel
+        {
+            int nt = omp_get_num_threads(), t = omp_get_thread_num();
+            int lo = (int)((long)n*t/nt), hi = (int)((long)n*(t+1)/nt);
+            int *hist = reorder.hist + t*RADIX_BUCKETS;
+
+            memset(hist, 0, RADIX_BUCKETS*sizeof(int));
+            for(int k=lo;k<hi;k++) hist[(keys[k] >> shift) & (RADIX_BUCKETS-1)]++;
+            #pragma omp barrier
+
+            #pragma omp single
+            {
+                int sum = 0;
+                for(int d=0; d<RADIX_BUCKETS; d++){
+                    for(int th=0; th<nt; th++){
+                        int c = reorder.hist[th*RADIX_BUCKETS + d];
+                        reorder.hist[th*RADIX_BUCKETS + d] = sum;
+                        sum += c;
+                    }
+                }
+            }
+
+            for(int k=lo;k<hi;k++){
+                int dst = hist[(keys[k] >> shift) & (RADIX_BUCKETS-1)]++;
+                keysTmp[dst] = keys[k];
+                valsTmp[dst] = vals[k];
+            }
+        }
+        Uint32 *tk = keys; keys = keysTmp; keysTmp = tk;
+        int *tv = vals; vals = valsTmp; valsTmp = tv;
+    }
+}
+
+// Aplicar la permutación reorder.order[0,m) a un arreglo de la esfera
+static void permuteSphereArray(void* data, size_t elemSize, int m){
+    char *src = data, *dst = reorder.gather;
+    #pragma omp parallel for schedule(static)
+    for(int k=0;k<m;k++){
+        memcpy(dst + k*elemSize, src + (size_t)reorder.order[k]*elemSize, elemSize);
+    }
+    memcpy(src, dst, m*elemSize);
+}
+
+void reorderSpheres(){
+    int m = spheres.activeCount;
+    if(m < 2) return;
+    ensureReorderCapacity(spheres.capacity);
+
+    // x y z se cuantizan a 10 bits en la caja del terreno (la altura con las esferas activas)
+    float minY = spheres.y[0], maxY = spheres.y[0];
+    #pragma omp parallel for reduction(min:minY) reduction(max:maxY)
+    for(int i=0;i<m;i++){
+        minY = fminf(minY, spheres.y[i]);
+        maxY = fmaxf(maxY, spheres.y[i]);
+    }
+    float sxz = 1023.0f/(gridSize*SCALE);
+    float sy = maxY > minY ? 1023.0f/(maxY - minY) : 0.0f;
+
+    #pragma omp parallel for schedule(static)
+    for(int i=0;i<m;i++){
+        Uint32 qx = (Uint32)fminf(fmaxf(spheres.x[i]*sxz, 0.0f), 1023.0f);
+        Uint32 qy = (Uint32)fminf(fmaxf((spheres.y[i] - minY)*sy, 0.0f), 1023.0f);
+        Uint32 qz = (Uint32)fminf(fmaxf(spheres.z[i]*sxz, 0.0f), 1023.0f);
+        reorder.keys[i] = mortonSpread(qx) | (mortonSpread(qy) << 1) | (mortonSpread(qz) << 2);
+        reorder.order[i] = i;
+    }
+
+    radixSortRange(0, spheres.awakeCount);
+    radixSortRange(spheres.awakeCount, m);
+
+    permuteSphereArray(spheres.x, sizeof(float), m);
+    permuteSphereArray(spheres.y, sizeof(float), m);
+    permuteSphereArray(spheres.z, sizeof(float), m);
+    permuteSphereArray(spheres.vx, sizeof(float), m);
+    permuteSphereArray(spheres.vy, sizeof(float), m);
+    permuteSphereArray(spheres.vz, sizeof(float), m);
+    permuteSphereArray(spheres.prevX, sizeof(float), m);
+    permuteSphereArray(spheres.prevY, sizeof(float), m);
+    permuteSphereArray(spheres.prevZ, sizeof(float), m);
+    permuteSphereArray(spheres.radius, sizeof(float), m);
+    permuteSphereArray(spheres.color, sizeof(SphereColor), m);
+    permuteSphereArray(spheres.floorY, sizeof(float), m);
+    permuteSphereArray(spheres.floorVel, sizeof(float), m);
+    permuteSphereArray(spheres.sleepFrames, sizeof(Uint8), m);
+    permuteSphereArray(spheres.flip, sizeof(Uint8), m);
+    permuteSphereArray(spheres.idOf, sizeof(int), m);
+
+    #pragma omp parallel for schedule(static)
+    for(int k=0;k<m;k++) spheres.slotOf[spheres.idOf[k]] = k;
+}
+
+void freeSnapshot(SphereSnapshot* sn){
+    free(sn->x); free(sn->y); free(sn->z);
+    free(sn->prevX); free(sn->prevY); free(sn->prevZ);
+    free(sn->radius);
+    free(sn->color);
+    *sn = (SphereSnapshot){0};
+}
+
+// Copiar el bloque activo del almacenamiento; alpha y renderT los completa quien la publica
+void takeSnapshot(SphereSnapshot* sn){
+    if(sn->capacity < spheres.capacity){
+        freeSnapshot(sn);
+        sn->capacity = spheres.capacity;
+        sn->x = sphereArray(sn->capacity, sizeof(float));
+        sn->y = sphereArray(sn->capacity, sizeof(float));
+        sn->z = sphereArray(sn->capacity, sizeof(float));
+        sn->prevX = sphereArray(sn->capacity, sizeof(float));
+        sn->prevY = sphereArray(sn->capacity, sizeof(float));
+        sn->prevZ = sphereArray(sn->capacity, sizeof(float));
+        sn->radius = sphereArray(sn->capacity, sizeof(float));
+        sn->color = sphereArray(sn->capacity, sizeof(SphereColor));
+    }
+    sn->count = spheres.activeCount;
+    sn->sleeping = spheres.activeCount - spheres.awakeCount;
+
+    int numBlocks = (sn->count + PHYSICS_BLOCK - 1) / PHYSICS_BLOCK;
+    #pragma omp parallel for schedule(static)
+    for(int blk=0; blk<numBlocks; blk++){
+        int begin = blk*PHYSICS_BLOCK;
+        int n = sn->count - begin < PHYSICS_BLOCK ? sn->count - begin : PHYSICS_BLOCK;
+        memcpy(&sn->x[begin], &spheres.x[begin], n*sizeof(float));
+        memcpy(&sn->y[begin], &spheres.y[begin], n*sizeof(float));
+        memcpy(&sn->z[begin], &spheres.z[begin], n*sizeof(float));
+        memcpy(&sn->prevX[begin], &spheres.prevX[begin], n*sizeof(float));
+        memcpy(&sn->prevY[begin], &spheres.prevY[begin], n*sizeof(float));
+        memcpy(&sn->prevZ[begin], &spheres.prevZ[begin], n*sizeof(float));
+        memcpy(&sn->radius[begin], &spheres.radius[begin], n*sizeof(float));
+        memcpy(&sn->color[begin], &spheres.color[begin], n*sizeof(SphereColor));
+    }
+}
 
 // Inicialización de esferas
-void initSpheres(int n){
-    // Calculo aleatorio de posición
-    srand((unsigned int)time(NULL));
-    if(n>DEF_SPHERES) n=DEF_SPHERES;
+void initSpheres(int n, unsigned int seed){
+    // Calculo aleatorio de posición (misma semilla -> misma escena)
+    srand(seed);
     numSpheres = n;
+    allocSpheres(numSpheres);
 
     // Registrar valores iniciales de la esfera
     for(int i=0;i<numSpheres;i++){
-        spheres[i].x = (rand()%gridSize)*SCALE;
-        spheres[i].z = (rand()%gridSize)*SCALE;
-        spheres[i].y = 20.0f + ((float)rand()/RAND_MAX)*60.0f;
-        spheres[i].vx = ((rand()%100)/100.0f -0.5f)*0.2f;
-        spheres[i].vz = ((rand()%100)/100.0f -0.5f)*0.2f;
-        spheres[i].vy = 0;
-        spheres[i].radius = 0.5f;
-        spheres[i].r = 0.3f + ((rand()%100)/100.0f)*0.7f;
-        spheres[i].g = 0.3f + ((rand()%100)/100.0f)*0.7f;
-        spheres[i].b = 0.3f + ((rand()%100)/100.0f)*0.7f;
-        spheres[i].active = 1;
+        spheres.x[i] = (rand()%gridSize)*SCALE;
+        spheres.z[i] = (rand()%gridSize)*SCALE;
+        spheres.y[i] = 20.0f + ((float)rand()/RAND_MAX)*60.0f;
+        spheres.vx[i] = ((rand()%100)/100.0f -0.5f)*0.2f;
+        spheres.vz[i] = ((rand()%100)/100.0f -0.5f)*0.2f;
+        spheres.vy[i] = 0;
+        spheres.radius[i] = 0.5f;
+        spheres.color[i].r = 0.3f + ((rand()%100)/100.0f)*0.7f;
+        spheres.color[i].g = 0.3f + ((rand()%100)/100.0f)*0.7f;
+        spheres.color[i].b = 0.3f + ((rand()%100)/100.0f)*0.7f;
     }
 }
 
+// Caida y rebote en paredes de una esfera (versión escalar); h es el paso en pasos base
+static inline void integrateScalar(int i, float wallMax, float h){
+    spheres.x[i] += spheres.vx[i]*h;
+    spheres.z[i] += spheres.vz[i]*h;
+    spheres.vy[i] += GRAVITY*h;
+    spheres.y[i] += spheres.vy[i]*h;
+    if(spheres.x[i]<0 || spheres.x[i]>wallMax) spheres.vx[i]*=-1;
+    if(spheres.z[i]<0 || spheres.z[i]>wallMax) spheres.vz[i]*=-1;
+}
 
-// Física de esferas y colisiones
-void updatePhysics(float t){
-    // Movimiento y rebotes
-    #pragma omp parallel for schedule(static)
-    for(int i=0;i<numSpheres;i++){
-        if(!spheres[i].active) continue;
-        // caida inicial
-        spheres[i].x += spheres[i].vx;
-        spheres[i].z += spheres[i].vz;
-        spheres[i].vy += GRAVITY;
-        spheres[i].y += spheres[i].vy;
+// Rebote con el terreno de una esfera (versión escalar)
+// El rebote es relativo al piso (que sube o baja con la ola): si llega lento se queda
+// apoyada con la velocidad del piso, y el roce frena el movimiento horizontal
+static inline void floorBounceScalar(int i, float floorY, float floorV){
+    if(spheres.y[i]<floorY){
+        spheres.y[i]=floorY;
+        float rel = spheres.vy[i] - floorV;
+        spheres.vy[i] = fabsf(rel) < GROUND_STICK ? floorV : floorV - BOUNCE*rel;
+        spheres.vx[i]*=GROUND_FRICTION;
+        spheres.vz[i]*=GROUND_FRICTION;
+    }
+}
+
+// Caida y rebote en paredes para [begin,end); begin debe estar alineado a 16
+static void integrateBlock(int begin, int end, float wallMax, float h){
+    int i = begin;
+#if defined(__AVX512F__)
+    const __m512 step = _mm512_set1_ps(h);
+    const __m512 g = _mm512_set1_ps(GRAVITY*h);
+    const __m512 zero = _mm512_setzero_ps();
+    const __m512 wall = _mm512_set1_ps(wallMax);
+    for(; i + 16 <= end; i += 16){
+        __m512 x = _mm512_load_ps(&spheres.x[i]);
+        __m512 y = _mm512_load_ps(&spheres.y[i]);
+        __m512 z = _mm512_load_ps(&spheres.z[i]);
+        __m512 vx = _mm512_load_ps(&spheres.vx[i]);
+        __m512 vy = _mm512_load_ps(&spheres.vy[i]);
+        __m512 vz = _mm512_load_ps(&spheres.vz[i]);
+
+        x = _mm512_add_ps(x, _mm512_mul_ps(vx, step));
+        z = _mm512_add_ps(z, _mm512_mul_ps(vz, step));
+        vy = _mm512_add_ps(vy, g);
+        y = _mm512_add_ps(y, _mm512_mul_ps(vy, step));
+
+        // rebote en la pared: invertir velocidad si sale de [0, wallMax]
+        __mmask16 outX = _mm512_cmp_ps_mask(x, zero, _CMP_LT_OQ) | _mm512_cmp_ps_mask(x, wall, _CMP_GT_OQ);
+        __mmask16 outZ = _mm512_cmp_ps_mask(z, zero, _CMP_LT_OQ) | _mm512_cmp_ps_mask(z, wall, _CMP_GT_OQ);
+        vx = _mm512_mask_sub_ps(vx, outX, zero, vx);
+        vz = _mm512_mask_sub_ps(vz, outZ, zero, vz);
+
+        _mm512_store_ps(&spheres.x[i], x);
+        _mm512_store_ps(&spheres.y[i], y);
+        _mm512_store_ps(&spheres.z[i], z);
+        _mm512_store_ps(&spheres.vx[i], vx);
+        _mm512_store_ps(&spheres.vy[i], vy);
+        _mm512_store_ps(&spheres.vz[i], vz);
+    }
+#elif defined(__AVX2__)
+    const __m256 step = _mm256_set1_ps(h);
+    const __m256 g = _mm256_set1_ps(GRAVITY*h);
+    const __m256 zero = _mm256_setzero_ps();
+    const __m256 wall = _mm256_set1_ps(wallMax);
+    const __m256 sign = _mm256_set1_ps(-0.0f);
+    for(; i + 8 <= end; i += 8){
+        __m256 x = _mm256_load_ps(&spheres.x[i]);
+        __m256 y = _mm256_load_ps(&spheres.y[i]);
+        __m256 z = _mm256_load_ps(&spheres.z[i]);
+        __m256 vx = _mm256_load_ps(&spheres.vx[i]);
+        __m256 vy = _mm256_load_ps(&spheres.vy[i]);
+        __m256 vz = _mm256_load_ps(&spheres.vz[i]);
+
+        x = _mm256_add_ps(x, _mm256_mul_ps(vx, step));
+        z = _mm256_add_ps(z, _mm256_mul_ps(vz, step));
+        vy = _mm256_add_ps(vy, g);
+        y = _mm256_add_ps(y, _mm256_mul_ps(vy, step));
+
+        // rebote en la pared: invertir velocidad si sale de [0, wallMax]
+        __m256 outX = _mm256_or_ps(_mm256_cmp_ps(x, zero, _CMP_LT_OQ), _mm256_cmp_ps(x, wall, _CMP_GT_OQ));
+        __m256 outZ = _mm256_or_ps(_mm256_cmp_ps(z, zero, _CMP_LT_OQ), _mm256_cmp_ps(z, wall, _CMP_GT_OQ));
+        vx = _mm256_xor_ps(vx, _mm256_and_ps(outX, sign));
+        vz = _mm256_xor_ps(vz, _mm256_and_ps(outZ, sign));
+
+        _mm256_store_ps(&spheres.x[i], x);
+        _mm256_store_ps(&spheres.y[i], y);
+        _mm256_store_ps(&spheres.z[i], z);
+        _mm256_store_ps(&spheres.vx[i], vx);
+        _mm256_store_ps(&spheres.vy[i], vy);
+        _mm256_store_ps(&spheres.vz[i], vz);
+    }
+#endif
+    for(; i < end; i++) integrateScalar(i, wallMax, h);
+}
+
+// Rebote con el terreno para [begin,end); floorY[k] es la altura del piso de begin+k
+static void floorBounceBlock(int begin, int end, const float* floorY, const float* floorV){
+    int i = begin;
+#if defined(__AVX512F__)
+    const __m512 bounce = _mm512_set1_ps(BOUNCE);
+    const __m512 stick = _mm512_set1_ps(GROUND_STICK);
+    const __m512 friction = _mm512_set1_ps(GROUND_FRICTION);
+    for(; i + 16 <= end; i += 16){
+        __m512 y = _mm512_load_ps(&spheres.y[i]);
+        __m512 vy = _mm512_load_ps(&spheres.vy[i]);
+        __m512 f = _mm512_loadu_ps(&floorY[i - begin]);
+        __m512 u = _mm512_loadu_ps(&floorV[i - begin]);
+        __mmask16 below = _mm512_cmp_ps_mask(y, f, _CMP_LT_OQ);
+        __m512 rel = _mm512_sub_ps(vy, u);
+        __mmask16 slow = _mm512_cmp_ps_mask(_mm512_abs_ps(rel), stick, _CMP_LT_OQ);
+        __m512 bounced = _mm512_mask_mov_ps(_mm512_sub_ps(u, _mm512_mul_ps(bounce, rel)), slow, u);
+        _mm512_store_ps(&spheres.y[i], _mm512_mask_mov_ps(y, below, f));
+        _mm512_store_ps(&spheres.vy[i], _mm512_mask_mov_ps(vy, below, bounced));
+        __m512 vx = _mm512_load_ps(&spheres.vx[i]);
+        __m512 vz = _mm512_load_ps(&spheres.vz[i]);
+        _mm512_store_ps(&spheres.vx[i], _mm512_mask_mul_ps(vx, below, vx, friction));
+        _mm512_store_ps(&spheres.vz[i], _mm512_mask_mul_ps(vz, below, vz, friction));
+    }
+#elif defined(__AVX2__)
+    const __m256 bounce = _mm256_set1_ps(BOUNCE);
+    const __m256 stick = _mm256_set1_ps(GROUND_STICK);
+    const __m256 friction = _mm256_set1_ps(GROUND_FRICTION);
+    const __m256 absMask = _mm256_castsi256_ps(_mm256_set1_epi32(0x7fffffff));
+    for(; i + 8 <= end; i += 8){
+        __m256 y = _mm256_load_ps(&spheres.y[i]);
+        __m256 vy = _mm256_load_ps(&spheres.vy[i]);
+        __m256 f = _mm256_loadu_ps(&floorY[i - begin]);
+        __m256 u = _mm256_loadu_ps(&floorV[i - begin]);
+        __m256 below = _mm256_cmp_ps(y, f, _CMP_LT_OQ);
+        __m256 rel = _mm256_sub_ps(vy, u);
+        __m256 slow = _mm256_cmp_ps(_mm256_and_ps(rel, absMask), stick, _CMP_LT_OQ);
+        __m256 bounced = _mm256_blendv_ps(_mm256_sub_ps(u, _mm256_mul_ps(bounce, rel)), u, slow);
+        _mm256_store_ps(&spheres.y[i], _mm256_blendv_ps(y, f, below));
+        _mm256_store_ps(&spheres.vy[i], _mm256_blendv_ps(vy, bounced, below));
+        __m256 vx = _mm256_load_ps(&spheres.vx[i]);
+        __m256 vz = _mm256_load_ps(&spheres.vz[i]);
+        _mm256_store_ps(&spheres.vx[i], _mm256_blendv_ps(vx, _mm256_mul_ps(vx, friction), below));
+        _mm256_store_ps(&spheres.vz[i], _mm256_blendv_ps(vz, _mm256_mul_ps(vz, friction), below));
+    }
+#endif
+    for(; i < end; i++) floorBounceScalar(i, floorY[i - begin], floorV[i - begin]);
+}
 
-        // rebote con el terreno
-        float floorY = waveHeight(spheres[i].x,spheres[i].z,t)+spheres[i].radius;
-        if(spheres[i].y<floorY){
-            spheres[i].y=floorY;
-            spheres[i].vy*=-BOUNCE;
+// Contadores de reposo de las despiertas de [begin,end): pegada al piso y casi quieta en
+// horizontal. El rebote invierte vy cada vez que el piso la alcanza, así que en vertical
+// solo se pide que no se separe del piso
+static inline void restingRange(int begin, int end){
+    for(int i=begin;i<end;i++){
+        float vh2 = spheres.vx[i]*spheres.vx[i] + spheres.vz[i]*spheres.vz[i];
+        int resting = spheres.y[i] - spheres.floorY[i] < SLEEP_CONTACT &&
+                      vh2 < SLEEP_SPEED*SLEEP_SPEED;
+        spheres.sleepFrames[i] = resting ? spheres.sleepFrames[i] + 1 : 0;
+        if(spheres.sleepFrames[i] >= SLEEP_FRAMES) spheres.flip[i] = 1;
+    }
+}
+
+// Cambios de estado; n es awakeCount al inicio del paso y los contadores ya están al día.
+// Las marcas se resuelven sobre slots (el grid sigue válido) y los cambios se aplican por id
+static void updateSleep(int n){
+    int m = spheres.activeCount;
+    if(m > sleepScratchCapacity){
+        free(sleepScratch);
+        sleepScratch = malloc(2 * m * sizeof(int));
+        sleepScratchCapacity = m;
+    }
+    int *sleepIds = sleepScratch;
+    int *wakeQueue = sleepScratch + m;
+
+    // islas: cada dormida que despierta despierta también a las dormidas que la tocan
+    int numWake = 0;
+    for(int i=n;i<m;i++){
+        if(spheres.flip[i]) wakeQueue[numWake++] = i;
+    }
+    for(int q=0;q<numWake;q++){
+        int s = wakeQueue[q];
+        const int *list;
+        int rangeBegin[27], rangeEnd[27];
+        int nr = broadphaseRanges(s, SLEEP_CONTACT, &list, rangeBegin, rangeEnd);
+        for(int r=0;r<nr;r++){
+            for(int k=rangeBegin[r]; k<rangeEnd[r]; k++){
+                int j = list[k];
+                if(j < n || spheres.flip[j]) continue;
+                float dx = spheres.x[j] - spheres.x[s];
+                float dy = spheres.y[j] - spheres.y[s];
+                float dz = spheres.z[j] - spheres.z[s];
+                float reach = spheres.radius[s] + spheres.radius[j] + SLEEP_CONTACT;
+                if(dx*dx + dy*dy + dz*dz < reach*reach){
+                    spheres.flip[j] = 1;
+                    wakeQueue[numWake++] = j;
+                }
+            }
         }
+    }
 
-        // rebote en la pared
-        if(spheres[i].x<0 || spheres[i].x>gridSize*SCALE) spheres[i].vx*=-1;
-        if(spheres[i].z<0 || spheres[i].z>gridSize*SCALE) spheres[i].vz*=-1;
+    // pasar de slots a ids antes de mover nada
+    int numSleep = 0;
+    for(int i=0;i<n;i++){
+        if(spheres.flip[i]){
+            spheres.flip[i] = 0;
+            sleepIds[numSleep++] = spheres.idOf[i];
+        }
+    }
+    for(int q=0;q<numWake;q++){
+        spheres.flip[wakeQueue[q]] = 0;
+        wakeQueue[q] = spheres.idOf[wakeQueue[q]];
     }
 
-    omp_lock_t *locks = malloc(numSpheres * sizeof(omp_lock_t));
-    for (int i = 0; i < numSpheres; i++) {
-        omp_init_lock(&locks[i]);
+    for(int k=0;k<numSleep;k++) sleepSphere(sleepIds[k]);
+    for(int k=0;k<numWake;k++) wakeSphere(wakeQueue[k]);
+}
+
+// Guardar la posición al inicio del paso para interpolar el dibujo entre dos pasos
+static inline void savePrevPositions(int begin, int end){
+    memcpy(&spheres.prevX[begin], &spheres.x[begin], (end-begin)*sizeof(float));
+    memcpy(&spheres.prevY[begin], &spheres.y[begin], (end-begin)*sizeof(float));
+    memcpy(&spheres.prevZ[begin], &spheres.z[begin], (end-begin)*sizeof(float));
+}
+
+// Bloque de despiertas: movimiento, piso y rebote con los datos del bloque en caché
+static void integrateAwakeRange(int begin, int end, float t, float h, float wallMax){
+    float floorY[PHYSICS_BLOCK], floorV[PHYSICS_BLOCK];
+
+    savePrevPositions(begin, end);
+    integrateBlock(begin, end, wallMax, h);
+
+    // altura del terreno bajo cada esfera, cuánto se movió desde el paso anterior y su
+    // velocidad en las unidades de vy
+    waveHeightBatch(&spheres.x[begin], &spheres.z[begin], floorY, end-begin, t);
+    for(int i=begin;i<end;i++){
+        float f = floorY[i-begin] + spheres.radius[i];
+        floorY[i-begin] = f;
+        spheres.floorVel[i] = f - spheres.floorY[i];
+        spheres.floorY[i] = f;
+        floorV[i-begin] = spheres.floorVel[i]/h;
     }
 
-    #pragma omp parallel for schedule(dynamic)
-    for (int i = 0; i < numSpheres; i++) {
-        for (int j = i + 1; j < numSpheres; j++) {
-            if (!spheres[i].active || !spheres[j].active) continue;
+    floorBounceBlock(begin, end, floorY, floorV);
+}
 
-            // Calculo de distancia entre esferas
-            float dx = spheres[j].x - spheres[i].x;
-            float dy = spheres[j].y - spheres[i].y;
-            float dz = spheres[j].z - spheres[i].z;
-            float dist = sqrtf(dx * dx + dy * dy + dz * dz);
-            float minDist = spheres[i].radius + spheres[j].radius;
-
-            if (dist < minDist && dist > 0.0f) {
-                // bloquear acceso concurrente a las dos esferas
-                omp_set_lock(&locks[i]);
-                omp_set_lock(&locks[j]);
-
-                // normal de colisión
-                float nx = dx / dist;
-                float ny = dy / dist;
-                float nz = dz / dist;
-
-                // separar esferas para evitar penetración
-                float overlap = minDist - dist;
-                spheres[i].x -= nx * overlap * 0.5f;
-                spheres[i].y -= ny * overlap * 0.5f;
-                spheres[i].z -= nz * overlap * 0.5f;
-                spheres[j].x += nx * overlap * 0.5f;
-                spheres[j].y += ny * overlap * 0.5f;
-                spheres[j].z += nz * overlap * 0.5f;
-
-                // calcular velocidad proyectada en la normal
-                float viDot = spheres[i].vx * nx + spheres[i].vy * ny + spheres[i].vz * nz;
-                float vjDot = spheres[j].vx * nx + spheres[j].vy * ny + spheres[j].vz * nz;
-                float avg = (viDot + vjDot) * 0.5f;
-
-                // actualizar velocidades (choque elástico)
-                spheres[i].vx += (avg - viDot) * nx;
-                spheres[i].vy += (avg - viDot) * ny;
-                spheres[i].vz += (avg - viDot) * nz;
-
-                spheres[j].vx += (avg - vjDot) * nx;
-                spheres[j].vy += (avg - vjDot) * ny;
-                spheres[j].vz += (avg - vjDot) * nz;
-
-                omp_unset_lock(&locks[j]);
-                omp_unset_lock(&locks[i]);
+// Bloque de dormidas: solo siguen la ola. Mientras el piso no cambie de velocidad más que la
+// gravedad la esfera no se despega, así que basta con copiar su altura y velocidad.
+// v es el desplazamiento del piso en este paso; su cambio entre pasos escala con h^2
+static void rideWaveRange(int begin, int end, float t, float h){
+    float wakeAccel = SLEEP_TERRAIN_ACCEL*h*h;
+    float floorY[PHYSICS_BLOCK];
+
+    savePrevPositions(begin, end);
+    waveHeightBatch(&spheres.x[begin], &spheres.z[begin], floorY, end-begin, t);
+    for(int i=begin;i<end;i++){
+        float f = floorY[i-begin] + spheres.radius[i];
+        float v = f - spheres.floorY[i];
+        if(fabsf(v - spheres.floorVel[i]) > wakeAccel) spheres.flip[i] = 1;
+        spheres.y[i] = f;
+        spheres.vy[i] = v/h;
+        spheres.floorY[i] = f;
+        spheres.floorVel[i] = v;
+    }
+}
+
+// Fase de detección para las despiertas de [begin,end): arma la lista de contactos del paso
+// con la fase amplia y toma de la caché el impulso que cada par traía del paso anterior
+// (arranque en caliente). Solo lee posiciones de las demás; cada tarea escribe los contactos
+// y la velocidad de sus esferas (y la marca de las dormidas que toca)
+static void detectRange(int begin, int end, int n){
+    for (int i = begin; i < end; i++) {
+        int id = spheres.idOf[i];
+        const int *oldOther = &contacts.other[id * MAX_CONTACTS];
+        const float *oldLambda = &contacts.lambda[id * MAX_CONTACTS];
+        int oldCount = contacts.count[id];
+        int *slot = &contacts.stepSlot[i * MAX_CONTACTS];
+        float *lambda = &contacts.stepLambda[i * MAX_CONTACTS];
+        int count = 0;
+        float wvx = 0.0f, wvy = 0.0f, wvz = 0.0f;
+
+        // solo se prueban los candidatos de la fase amplia (celdas vecinas o tramo en x)
+        const int *list;
+        int rangeBegin[27], rangeEnd[27];
+        int nr = broadphaseRanges(i, CONTACT_MARGIN, &list, rangeBegin, rangeEnd);
+
+        for (int r = 0; r < nr; r++) {
+            for (int k = rangeBegin[r]; k < rangeEnd[r]; k++) {
+                int j = list[k];
+                if (j == i) continue;
+
+                // Calculo de distancia entre esferas
+                float dx = spheres.x[j] - spheres.x[i];
+                float dy = spheres.y[j] - spheres.y[i];
+                float dz = spheres.z[j] - spheres.z[i];
+                float dist = sqrtf(dx * dx + dy * dy + dz * dz);
+                float minDist = spheres.radius[i] + spheres.radius[j];
+
+                // el par se conserva un poco más allá del contacto para no perder su impulso
+                // si rebota; más lejos se descarta
+                if (dist >= minDist + CONTACT_MARGIN || dist <= 0.0f) continue;
+
+                // una despierta que choca con una dormida la despierta (y a su isla); un
+                // roce de una vecina que también está casi quieta no cuenta
+                if (j >= n && dist < minDist) {
+                    float rvx = spheres.vx[i] - spheres.vx[j];
+                    float rvy = spheres.vy[i] - spheres.vy[j];
+                    float rvz = spheres.vz[i] - spheres.vz[j];
+                    if (rvx * rvx + rvy * rvy + rvz * rvz > SLEEP_WAKE_SPEED * SLEEP_WAKE_SPEED ||
+                        minDist - dist > SLEEP_CONTACT) {
+                        #pragma omp atomic write
+                        spheres.flip[j] = 1;
+                    }
+                }
+                if (count == MAX_CONTACTS) continue;
+
+                // impulso del paso anterior si el par ya estaba en la caché
+                int jid = spheres.idOf[j];
+                float l = 0.0f;
+                for (int c = 0; c < oldCount; c++) {
+                    if (oldOther[c] == jid) { l = oldLambda[c] * WARM_START; break; }
+                }
+                slot[count] = j;
+                lambda[count] = l;
+                count++;
+
+                // arranque en caliente: se reaplica el impulso solo si siguen en contacto
+                if (dist < minDist) {
+                    wvx -= l * dx / dist;
+                    wvy -= l * dy / dist;
+                    wvz -= l * dz / dist;
+                }
             }
         }
+        contacts.stepCount[i] = count;
+        spheres.vx[i] += wvx;
+        spheres.vy[i] += wvy;
+        spheres.vz[i] += wvz;
     }
+}
 
+// Una iteración de resolución sobre los contactos del paso de [begin,end) (Jacobi: solo lee
+// el estado, cada esfera acumula sus correcciones y su mitad de cada par). Los dos lados de
+// un par calculan el mismo impulso, así que cada uno guarda su copia
+static void solveRange(int begin, int end){
+    for (int i = begin; i < end; i++) {
+        CollisionBuffer acc = {0};
+        const int *slot = &contacts.stepSlot[i * MAX_CONTACTS];
+        float *lambda = &contacts.stepLambda[i * MAX_CONTACTS];
+
+        for (int c = 0; c < contacts.stepCount[i]; c++) {
+            int j = slot[c];
+            float dx = spheres.x[j] - spheres.x[i];
+            float dy = spheres.y[j] - spheres.y[i];
+            float dz = spheres.z[j] - spheres.z[i];
+            float dist = sqrtf(dx * dx + dy * dy + dz * dz);
+            float overlap = spheres.radius[i] + spheres.radius[j] - dist;
+            if (overlap <= 0.0f || dist <= 0.0f) continue;
+
+            // normal de colisión
+            float nx = dx / dist;
+            float ny = dy / dist;
+            float nz = dz / dist;
+
+            // separar esferas para evitar penetración (la mitad le toca a i,
+            // la otra mitad la calcula j cuando recorre a i)
+            acc.dx -= nx * overlap * 0.5f;
+            acc.dy -= ny * overlap * 0.5f;
+            acc.dz -= nz * overlap * 0.5f;
+
+            // impulso para igualar las velocidades normales; el acumulado del par no puede
+            // ser negativo (el contacto empuja, no tira)
+            float vn = (spheres.vx[j] - spheres.vx[i]) * nx +
+                       (spheres.vy[j] - spheres.vy[i]) * ny +
+                       (spheres.vz[j] - spheres.vz[i]) * nz;
+            float l = fmaxf(lambda[c] - vn * 0.5f, 0.0f);
+            float p = l - lambda[c];
+            lambda[c] = l;
+
+            acc.dvx -= p * nx;
+            acc.dvy -= p * ny;
+            acc.dvz -= p * nz;
+        }
+        collisionBuf[i] = acc;
+    }
+}
+
+// Fase de aplicación: cada esfera suma sus propias correcciones, sin locks
+static inline void applyRange(int begin, int end){
+    for (int i = begin; i < end; i++) {
+        spheres.x[i] += collisionBuf[i].dx;
+        spheres.y[i] += collisionBuf[i].dy;
+        spheres.z[i] += collisionBuf[i].dz;
+        spheres.vx[i] += collisionBuf[i].dvx;
+        spheres.vy[i] += collisionBuf[i].dvy;
+        spheres.vz[i] += collisionBuf[i].dvz;
+    }
 }
 
-// Reset Z-buffer 
-void resetZBuffer() {
-    // Usar memset para mayor velocidad
+// Guardar en la caché (por id) los contactos del paso y sus impulsos; los pares que no se
+// encontraron en este paso desaparecen
+static inline void storeContactsRange(int begin, int end){
+    for (int i = begin; i < end; i++) {
+        int id = spheres.idOf[i];
+        int count = contacts.stepCount[i];
+        for (int c = 0; c < count; c++) {
+            contacts.other[id * MAX_CONTACTS + c] = spheres.idOf[contacts.stepSlot[i * MAX_CONTACTS + c]];
+            contacts.lambda[id * MAX_CONTACTS + c] = contacts.stepLambda[i * MAX_CONTACTS + c];
+        }
+        contacts.count[id] = count;
+    }
+}
+
+// Física de esferas y colisiones: un paso de h pasos base, con la ola en el tiempo t.
+// El paso es un grafo de tareas sobre el equipo de OpenMP: cada bloque se integra y se
+// reparte en el grid en cuanto puede, la detección arranca apenas el grid está ordenado
+// y sin barreras entre fases salvo las que imponen los datos
+void updatePhysics(float t, float h){
+    stageBegin(STAGE_INTEGRATE);
+    float wallMax = gridSize*SCALE;
+    int n = spheres.awakeCount;   // solo las despiertas se integran y buscan colisiones
+    int m = spheres.activeCount;
+    int numBlocks = (m + PHYSICS_BLOCK - 1) / PHYSICS_BLOCK;
+    int numChunks = (n + COLLIDE_CHUNK - 1) / COLLIDE_CHUNK;
+    int iterations = contactIterations > 0 ? contactIterations : 1;
+
+    // tres marcas de fase y una por bloque, por trozo de detección/resolución y por trozo
+    // de aplicación
+    int numDeps = numBlocks + 2*numChunks + 3;
+    if(numDeps > stepDepsCapacity){
+        free(stepDeps);
+        stepDeps = malloc(numDeps);
+        stepDepsCapacity = numDeps;
+    }
+    Uint8 *phaseDone = stepDeps;   // [0] fase amplia ordenada, [1] resolución completa, [2] aplicación completa
+    Uint8 *blockDone = phaseDone + 3;
+    Uint8 *solveDone = blockDone + numBlocks;
+    Uint8 *applyDone = solveDone + numChunks;
+    (void)applyDone;   // GCC no cuenta los usos que solo aparecen en cláusulas depend
+
+    prepareBroadphase(m);
+    ensureContactCapacity(spheres.capacity);
+
     #pragma omp parallel
+    #pragma omp single
     {
-        int chunk = (windowWidth * windowHeight) / omp_get_num_threads();
-        int start = omp_get_thread_num() * chunk;
-        int end = (omp_get_thread_num() == omp_get_num_threads()-1) ? 
-                 windowWidth * windowHeight : start + chunk;
-        
-        for(int i = start; i < end; i++) {
-            zbuffer[i] = 1e30f;
-            frameBuffer[i] = 0;
+        // bloques de [0,m): los que empiezan antes de n son de despiertas (el último puede
+        // mezclar ambos lados y se corta en n)
+        for(int blk=0; blk<numBlocks; blk++){
+            #pragma omp task firstprivate(blk) depend(out: blockDone[blk])
+            {
+                int begin = blk*PHYSICS_BLOCK;
+                int end = begin + PHYSICS_BLOCK < m ? begin + PHYSICS_BLOCK : m;
+                int split = end < n ? end : (begin > n ? begin : n);
+                if(begin < split) integrateAwakeRange(begin, split, t, h, wallMax);
+                if(split < end) rideWaveRange(split, end, t, h);
+                if(broadphase == BROADPHASE_GRID) hashGridRange(begin, end);
+            }
+        }
+
+        // ordenar el grid (o el barrido) necesita las posiciones de todos los bloques
+        #pragma omp task depend(iterator(k=0:numBlocks), in: blockDone[k]) depend(out: phaseDone[0])
+        {
+            stageEnd(STAGE_INTEGRATE);
+            stageBegin(STAGE_COLLIDE);
+            if(broadphase == BROADPHASE_SAP) sortSweep(m);
+            else sortGrid(m);
+        }
+
+        for(int c=0; c<numChunks; c++){
+            #pragma omp task firstprivate(c) depend(in: phaseDone[0]) depend(out: solveDone[c])
+            {
+                int begin = c*COLLIDE_CHUNK;
+                detectRange(begin, begin + COLLIDE_CHUNK < n ? begin + COLLIDE_CHUNK : n, n);
+            }
+        }
+        #pragma omp task depend(iterator(k=0:numChunks), in: solveDone[k]) depend(out: phaseDone[2])
+        {}
+
+        // cada iteración resuelve y aplica. Aplicar mueve esferas que otros trozos todavía
+        // pueden estar leyendo: entre fases se espera con una sola tarea de unión en vez de
+        // numChunks^2 aristas, y las marcas se reusan entre iteraciones
+        for(int it=0; it<iterations; it++){
+            int last = it == iterations-1;
+
+            for(int c=0; c<numChunks; c++){
+                #pragma omp task firstprivate(c) depend(in: phaseDone[2]) depend(out: solveDone[c])
+                {
+                    int begin = c*COLLIDE_CHUNK;
+                    solveRange(begin, begin + COLLIDE_CHUNK < n ? begin + COLLIDE_CHUNK : n);
+                }
+            }
+            #pragma omp task depend(iterator(k=0:numChunks), in: solveDone[k]) depend(out: phaseDone[1])
+            {}
+
+            for(int c=0; c<numChunks; c++){
+                #pragma omp task firstprivate(c, last) depend(in: phaseDone[1]) depend(out: applyDone[c])
+                {
+                    int begin = c*COLLIDE_CHUNK;
+                    int end = begin + COLLIDE_CHUNK < n ? begin + COLLIDE_CHUNK : n;
+                    applyRange(begin, end);
+                    if(last){
+                        restingRange(begin, end);
+                        storeContactsRange(begin, end);
+                    }
+                }
+            }
+            #pragma omp task depend(iterator(k=0:numChunks), in: applyDone[k]) depend(out: phaseDone[2])
+            {}
+        }
+
+        // islas y partición despiertas/dormidas, con la fase amplia del paso todavía válida
+        #pragma omp task depend(in: phaseDone[2]) depend(in: phaseDone[0])
+        {
+            updateSleep(n);
+            stageEnd(STAGE_COLLIDE);
         }
     }
 }
 
-// Versión de drawTriangle que recorta a un cuadrante
+// Versión de drawTriangle que recorta a un cuadrante.
+// Funciones de arista enteras que avanzan de forma incremental: por cada fila se calcula
+// directamente el tramo [xl, xr] donde las tres aristas son >= 0 (filas vacías se saltan sin
+// tocar pixeles) y la profundidad se interpola con un incremento constante por pixel.
 void drawTriangleClipped(int x1,int y1,float z1,
                          int x2,int y2,float z2,
                          int x3,int y3,float z3,
                          Uint32 color,
                          int minX,int maxX,int minY,int maxY)
 {
-    // calculo del cuadrado más pequeño para el triangulo
-    int minTx = fmax(minX, fmin(x1, fmin(x2, x3)));
-    int maxTx = fmin(maxX-1, fmax(x1, fmax(x2, x3)));
-    int minTy = fmax(minY, fmin(y1, fmin(y2, y3)));
-    int maxTy = fmin(maxY-1, fmax(y1, fmax(y2, y3)));
+    // dos veces el área con signo; se ordenan los vértices para que sea positiva
+    long long area = (long long)(x2 - x1)*(y3 - y1) - (long long)(x3 - x1)*(y2 - y1);
+    if(area == 0) return;
+    if(area < 0){
+        int tx = x2; x2 = x3; x3 = tx;
+        int ty = y2; y2 = y3; y3 = ty;
+        float tz = z2; z2 = z3; z3 = tz;
+        area = -area;
+    }
 
-    // denominador (aproximadamente) dos veces el área
-    float denom = (float)((y2 - y3)*(x1 - x3) + (x3 - x2)*(y1 - y3));
+    // calculo del cuadrado más pequeño para el triangulo
+    int minTx = x1 < x2 ? (x1 < x3 ? x1 : x3) : (x2 < x3 ? x2 : x3);
+    int maxTx = x1 > x2 ? (x1 > x3 ? x1 : x3) : (x2 > x3 ? x2 : x3);
+    int minTy = y1 < y2 ? (y1 < y3 ? y1 : y3) : (y2 < y3 ? y2 : y3);
+    int maxTy = y1 > y2 ? (y1 > y3 ? y1 : y3) : (y2 > y3 ? y2 : y3);
+    if(minTx < minX) minTx = minX;
+    if(maxTx > maxX-1) maxTx = maxX-1;
+    if(minTy < minY) minTy = minY;
+    if(maxTy > maxY-1) maxTy = maxY-1;
+    if(minTx > maxTx || minTy > maxTy) return;
+
+    // aristas 2->3, 3->1 y 1->2: E(x,y) = A*x + B*y + C, positivas dentro del triángulo
+    long long A[3] = { y2 - y3, y3 - y1, y1 - y2 };
+    long long B[3] = { x3 - x2, x1 - x3, x2 - x1 };
+    long long row[3] = {
+        A[0]*(minTx - x2) + B[0]*(minTy - y2),
+        A[1]*(minTx - x3) + B[1]*(minTy - y3),
+        A[2]*(minTx - x1) + B[2]*(minTy - y1)
+    };
+
+    // profundidad = (E0*z1 + E1*z2 + E2*z3) / área, lineal en x e y
+    float invArea = 1.0f / (float)area;
+    float dzdx = (A[0]*z1 + A[1]*z2 + A[2]*z3) * invArea;
+    float dzdy = (B[0]*z1 + B[1]*z2 + B[2]*z3) * invArea;
+    float zRow = (row[0]*z1 + row[1]*z2 + row[2]*z3) * invArea;
 
-    // pesos baricéntricos, para saber si un pixel debe pintarse o no, para este triángulo
     for(int y = minTy; y <= maxTy; y++){
-        for(int x = minTx; x <= maxTx; x++){
-            float w1 = ((y2 - y3)*(x - x3) + (x3 - x2)*(y - y3)) / denom;
-            float w2 = ((y3 - y1)*(x - x3) + (x1 - x3)*(y - y3)) / denom;
-            float w3 = 1.0f - w1 - w2; // la suma de los pesos es 1
-
-            if(w1 >= 0 && w2 >= 0 && w3 >= 0){
-                float depth = w1*z1 + w2*z2 + w3*z3;
-                int idx = y*windowWidth + x;
+        // tramo de la fila donde las tres aristas son >= 0
+        int xl = minTx, xr = maxTx;
+        for(int e = 0; e < 3 && xl <= xr; e++){
+            if(A[e] > 0){
+                if(row[e] < 0){
+                    long long step = (-row[e] + A[e] - 1) / A[e];
+                    if(minTx + step > xl) xl = (int)(minTx + step > maxTx + 1 ? maxTx + 1 : minTx + step);
+                }
+            } else if(A[e] < 0){
+                if(row[e] < 0){ xr = xl - 1; break; }
+                long long step = row[e] / -A[e];
+                if(minTx + step < xr) xr = (int)(minTx + step);
+            } else if(row[e] < 0){
+                xr = xl - 1;
+            }
+        }
+
+        if(xl <= xr){
+            float depth = zRow + dzdx*(xl - minTx);
+            int idx = y*windowWidth + xl;
+            for(int x = xl; x <= xr; x++, idx++){
                 if(depth < zbuffer[idx]){
                     zbuffer[idx] = depth;
                     frameBuffer[idx] = color;
                 }
+                depth += dzdx;
+            }
+        }
+
+        row[0] += B[0]; row[1] += B[1]; row[2] += B[2];
+        zRow += dzdy;
+    }
+}
+
+// Render por tiles: una fase paralela proyecta y reparte triángulos y esferas en tiles de
+// TILE_SIZE x TILE_SIZE, luego los hilos toman tiles de una cola y dibujan solo lo que les toca
+#define TILE_SIZE 64
+#define HIZ_BLOCK 8     // lado del bloque del z-buffer jerárquico (divide a TILE_SIZE)
+
+// Triángulo del terreno ya proyectado
+typedef struct {
+    int x[3], y[3];
+    float z[3];
+    Uint32 color;
+} TriSetup;
+
+// Esfera ya proyectada
+typedef struct {
+    float sx, sy, depth;
+    int radius;     // radio en pixeles
+    int sphere;     // índice en spheres
+    Uint32 flat;    // color de un solo tono para radio 0
+} SphereSplat;
+
+// Lista de primitivas de un tile para un hilo
+typedef struct {
+    int* items;
+    int count, capacity;
+} BinList;
+
+typedef struct {
+    int tilesX, tilesY, numTiles, numThreads;
+    BinList* triBins;       // [hilo][tile]
+    BinList* splatBins;     // [hilo][tile]
+    TriSetup* tris;         // cuatro lugares por cuadro del terreno (2 triángulos, recortados)
+    int triCapacity;
+    SphereSplat* splats;    // uno por esfera
+    int splatCapacity;
+    float* hiZ;             // profundidad máxima de cada bloque HIZ_BLOCK x HIZ_BLOCK tras el terreno
+    int hiZW, hiZH;
+} TileRenderer;
+
+TileRenderer tiles = {0};
+
+static void freeBins(BinList* bins, int n){
+    if(!bins) return;
+    for(int k=0;k<n;k++) free(bins[k].items);
+    free(bins);
+}
+
+void freeTileRenderer(TileRenderer* tl){
+    freeBins(tl->triBins, tl->numThreads * tl->numTiles);
+    freeBins(tl->splatBins, tl->numThreads * tl->numTiles);
+    free(tl->tris);
+    free(tl->splats);
+    free(tl->hiZ);
+    *tl = (TileRenderer){0};
+}
+
+// Ajustar tiles al tamaño de ventana y primitivas a la escena; vaciar las listas
+void prepareTileRenderer(TileRenderer* tl, int numTris, int numSplats){
+    int tilesX = (windowWidth + TILE_SIZE - 1) / TILE_SIZE;
+    int tilesY = (windowHeight + TILE_SIZE - 1) / TILE_SIZE;
+    int numThreads = omp_get_max_threads();
+    if(tilesX != tl->tilesX || tilesY != tl->tilesY || numThreads != tl->numThreads){
+        freeBins(tl->triBins, tl->numThreads * tl->numTiles);
+        freeBins(tl->splatBins, tl->numThreads * tl->numTiles);
+        tl->tilesX = tilesX;
+        tl->tilesY = tilesY;
+        tl->numTiles = tilesX * tilesY;
+        tl->numThreads = numThreads;
+        tl->triBins = calloc(numThreads * tl->numTiles, sizeof(BinList));
+        tl->splatBins = calloc(numThreads * tl->numTiles, sizeof(BinList));
+    }
+    int hiZW = (windowWidth + HIZ_BLOCK - 1) / HIZ_BLOCK;
+    int hiZH = (windowHeight + HIZ_BLOCK - 1) / HIZ_BLOCK;
+    if(hiZW != tl->hiZW || hiZH != tl->hiZH){
+        free(tl->hiZ);
+        tl->hiZ = malloc(hiZW * hiZH * sizeof(float));
+        tl->hiZW = hiZW;
+        tl->hiZH = hiZH;
+    }
+    if(numTris > tl->triCapacity){
+        free(tl->tris);
+        tl->tris = malloc(numTris * sizeof(TriSetup));
+        tl->triCapacity = numTris;
+    }
+    if(numSplats > tl->splatCapacity){
+        free(tl->splats);
+        tl->splats = malloc(numSplats * sizeof(SphereSplat));
+        tl->splatCapacity = numSplats;
+    }
+    for(int k=0;k<numThreads * tl->numTiles;k++){
+        tl->triBins[k].count = 0;
+        tl->splatBins[k].count = 0;
+    }
+}
+
+static inline void binPush(BinList* bin, int item){
+    if(bin->count == bin->capacity){
+        bin->capacity = bin->capacity ? 2*bin->capacity : 64;
+        bin->items = realloc(bin->items, bin->capacity * sizeof(int));
+    }
+    bin->items[bin->count++] = item;
+}
+
+// Agregar una primitiva a las listas del hilo para cada tile que toca su rectángulo en pantalla
+static void binRect(TileRenderer* tl, BinList* threadBins, int item,
+                    int minPx, int maxPx, int minPy, int maxPy){
+    if(minPx < 0) minPx = 0;
+    if(minPy < 0) minPy = 0;
+    if(maxPx > windowWidth-1) maxPx = windowWidth-1;
+    if(maxPy > windowHeight-1) maxPy = windowHeight-1;
+    if(minPx > maxPx || minPy > maxPy) return;
+
+    for(int ty = minPy / TILE_SIZE; ty <= maxPy / TILE_SIZE; ty++){
+        for(int tx = minPx / TILE_SIZE; tx <= maxPx / TILE_SIZE; tx++){
+            binPush(&threadBins[ty * tl->tilesX + tx], item);
+        }
+    }
+}
+
+// Armar el triángulo idx[0..2] de los arreglos proyectados en el lugar slot de tl->tris
+// y repartirlo en los tiles que toca
+static void binTriangle(TileRenderer* tl, BinList* threadBins, int slot,
+                        const float* sx, const float* sy, const float* depth,
+                        const int idx[3], Uint32 color){
+    TriSetup* tri = &tl->tris[slot];
+    int minPx = INT_MAX, maxPx = INT_MIN, minPy = INT_MAX, maxPy = INT_MIN;
+    for(int c = 0; c < 3; c++){
+        tri->x[c] = sx[idx[c]];
+        tri->y[c] = sy[idx[c]];
+        tri->z[c] = depth[idx[c]];
+        if(tri->x[c] < minPx) minPx = tri->x[c];
+        if(tri->x[c] > maxPx) maxPx = tri->x[c];
+        if(tri->y[c] < minPy) minPy = tri->y[c];
+        if(tri->y[c] > maxPy) maxPy = tri->y[c];
+    }
+    tri->color = color;
+    binRect(tl, threadBins, slot, minPx, maxPx, minPy, maxPy);
+}
+
+// Guardar la profundidad máxima de cada bloque del tile [minX,maxX) x [minY,maxY),
+// una vez que el terreno ya está dibujado en él
+static void buildTileHiZ(TileRenderer* tl, int minX, int maxX, int minY, int maxY){
+    for(int by = minY; by < maxY; by += HIZ_BLOCK){
+        int byEnd = by + HIZ_BLOCK < maxY ? by + HIZ_BLOCK : maxY;
+        for(int bx = minX; bx < maxX; bx += HIZ_BLOCK){
+            int bxEnd = bx + HIZ_BLOCK < maxX ? bx + HIZ_BLOCK : maxX;
+            float zmax = 0.0f;
+            for(int y = by; y < byEnd; y++){
+                const float* row = &zbuffer[y * windowWidth];
+                for(int x = bx; x < bxEnd; x++) zmax = row[x] > zmax ? row[x] : zmax;
             }
+            tl->hiZ[(by / HIZ_BLOCK) * tl->hiZW + bx / HIZ_BLOCK] = zmax;
         }
     }
 }
 
-// renderización de terreno y esferas en el cuadrante
-void renderSceneQuadrant(int minX,int maxX,int minY,int maxY,
-                         SDL_Renderer* renderer,float t,
-                         float lightX,float lightY,float lightZ,
-                         float camX,float camY,float camZ,
-                         float lookX,float lookY,float lookZ,
-                         float* precomputedHeights)
+// Una esfera se dibuja con profundidad constante: si en todos los bloques que toca su
+// cuadrado el terreno ya está más cerca que ella, ningún pixel pasaría el z-test
+static int splatOccluded(const TileRenderer* tl, float depth,
+                         int minPx, int maxPx, int minPy, int maxPy){
+    if(minPx < 0) minPx = 0;
+    if(minPy < 0) minPy = 0;
+    if(maxPx > windowWidth-1) maxPx = windowWidth-1;
+    if(maxPy > windowHeight-1) maxPy = windowHeight-1;
+    if(minPx > maxPx || minPy > maxPy) return 1;
+
+    for(int by = minPy / HIZ_BLOCK; by <= maxPy / HIZ_BLOCK; by++){
+        const float* row = &tl->hiZ[by * tl->hiZW];
+        for(int bx = minPx / HIZ_BLOCK; bx <= maxPx / HIZ_BLOCK; bx++){
+            if(depth < row[bx]) return 0;
+        }
+    }
+    return 1;
+}
+
+// ===== Sprites de esfera por radio en pantalla =====
+// Para cada radio entero 1..SPRITE_MAX_RADIUS se guarda el medio ancho de cada fila del
+// disco y la normal unitaria de cada pixel, así el sombreado no calcula raíces por pixel.
+#define SPRITE_MAX_RADIUS 32
+#define SPRITE_DIRECTIONAL 0.05f    // radio / distancia a la luz bajo el cual la luz es direccional
+
+typedef struct {
+    int side;               // 2*radio + 1
+    int* halfWidth;         // por fila (dy + radio): mayor |dx| dentro del disco
+    float *nx, *ny, *nz;    // normal de cada pixel del cuadrado side x side
+} SphereSprite;
+
+SphereSprite sprites[SPRITE_MAX_RADIUS + 1];
+
+void initSphereSprites(void){
+    for(int r = 1; r <= SPRITE_MAX_RADIUS; r++){
+        SphereSprite* spr = &sprites[r];
+        int side = 2*r + 1;
+        spr->side = side;
+        spr->halfWidth = malloc(side * sizeof(int));
+        spr->nx = malloc(side * side * sizeof(float));
+        spr->ny = malloc(side * side * sizeof(float));
+        spr->nz = malloc(side * side * sizeof(float));
+        for(int dy = -r; dy <= r; dy++){
+            int hw = 0;
+            while((hw+1)*(hw+1) + dy*dy <= r*r) hw++;
+            spr->halfWidth[dy + r] = hw;
+            for(int dx = -r; dx <= r; dx++){
+                // mismas operaciones que el cálculo por pixel original
+                int k = (dy + r)*side + dx + r;
+                float nx = dx/(float)r;
+                float ny = -dy/(float)r;
+                spr->nx[k] = nx;
+                spr->ny[k] = ny;
+                spr->nz[k] = sqrtf(fmaxf(0.0f, 1 - nx*nx - ny*ny));
+            }
+        }
+    }
+}
+
+void freeSphereSprites(void){
+    for(int r = 1; r <= SPRITE_MAX_RADIUS; r++){
+        free(sprites[r].halfWidth);
+        free(sprites[r].nx); free(sprites[r].ny); free(sprites[r].nz);
+        sprites[r] = (SphereSprite){0};
+    }
+}
+
+// Niveles de detalle de esferas lejanas: radio 0 es un solo pixel de color plano y los
+// radios 1..3 recorren listas fijas de desplazamientos (dx, dy) del disco
+#define LOD_MASK_RADIUS 3
+static const signed char lodMask1[5][2] = {
+    {0,-1}, {-1,0}, {0,0}, {1,0}, {0,1}
+};
+static const signed char lodMask2[13][2] = {
+    {0,-2}, {-1,-1}, {0,-1}, {1,-1}, {-2,0}, {-1,0}, {0,0}, {1,0}, {2,0},
+    {-1,1}, {0,1}, {1,1}, {0,2}
+};
+static const signed char lodMask3[29][2] = {
+    {0,-3}, {-2,-2}, {-1,-2}, {0,-2}, {1,-2}, {2,-2}, {-2,-1}, {-1,-1}, {0,-1}, {1,-1},
+    {2,-1}, {-3,0}, {-2,0}, {-1,0}, {0,0}, {1,0}, {2,0}, {3,0}, {-2,1}, {-1,1},
+    {0,1}, {1,1}, {2,1}, {-2,2}, {-1,2}, {0,2}, {1,2}, {2,2}, {0,3}
+};
+static const signed char (*const lodMasks[LOD_MASK_RADIUS + 1])[2] = { NULL, lodMask1, lodMask2, lodMask3 };
+static const int lodMaskCount[LOD_MASK_RADIUS + 1] = { 0, 5, 13, 29 };
+
+// Color plano de una esfera de radio 0: difuso del centro del disco (normal (0,0,1))
+static inline Uint32 sphereFlatColor(int i, float lightX, float lightY, float lightZ){
+    float lx = lightX - projected.sphereWX[i], ly = lightY - projected.sphereWY[i], lz = lightZ - projected.sphereWZ[i];
+    float diff = fmaxf(0.0f, lz/sqrtf(lx*lx + ly*ly + lz*lz));
+    Uint8 r = (Uint8)(drawSpheres->color[i].r*255*diff);
+    Uint8 g = (Uint8)(drawSpheres->color[i].g*255*diff);
+    Uint8 b = (Uint8)(drawSpheres->color[i].b*255*diff);
+    return (r<<16)|(g<<8)|b;
+}
+
+// Dibujar una esfera recortada al rectángulo [minX,maxX) x [minY,maxY)
+static void drawSphereSplat(const SphereSplat* sp,
+                            float lightX,float lightY,float lightZ,
+                            int minX,int maxX,int minY,int maxY)
 {
-    // terreno con vectorización
-    for (int i = 0; i < gridSize - 1; i++) {
-        for (int j = 0; j < gridSize - 1; j += 2) {
-            int maxK = (gridSize - j < 2) ? (gridSize - j) : 2;
-            
-            // Paralelización vectorizada para pequeños bucles internos
-            #pragma omp simd
-            for (int k = 0; k < maxK; k++) {
-                int current_j = j + k;
-                
-                // calcular coordenadas 3D de los vértices del terreno
-                float x0 = i * SCALE, z0 = current_j * SCALE;
-                float x1 = (i + 1) * SCALE, z1 = current_j * SCALE;
-                float x2 = i * SCALE, z2 = (current_j + 1) * SCALE;
-                float x3 = (i + 1) * SCALE, z3 = (current_j + 1) * SCALE;
-
-                // altura precalculada para cada vértice
-                float y0 = precomputedHeights[i * gridSize + current_j];
-                float y1 = precomputedHeights[(i + 1) * gridSize + current_j];
-                float y2 = precomputedHeights[i * gridSize + (current_j + 1)];
-                float y3 = precomputedHeights[(i + 1) * gridSize + (current_j + 1)];
-                
-                // calcular centro del cuadrado
-                float centerX = (x0 + x1 + x2 + x3) * 0.25f;
-                float centerY = (y0 + y1 + y2 + y3) * 0.25f;
-                float centerZ = (z0 + z1 + z2 + z3) * 0.25f;
-
-                // distancia al cámara para no dibujar demasiado cerca
-                float dx = centerX - camX;
-                float dy = centerY - camY;
-                float dz = centerZ - camZ;
-                float dist2 = dx * dx + dy * dy + dz * dz;
-                if (dist2 < 1.0f) continue;
-
-                // proyectar los vértices
-                float sx0, sy0, sz0, sx1, sy1, sz1, sx2, sy2, sz2, sx3, sy3, sz3;
-                project3D(camX, camY, camZ, camX + lookX, camY + lookY, camZ + lookZ,
-                         x0, y0, z0, &sx0, &sy0, &sz0);
-                project3D(camX, camY, camZ, camX + lookX, camY + lookY, camZ + lookZ,
-                         x1, y1, z1, &sx1, &sy1, &sz1);
-                project3D(camX, camY, camZ, camX + lookX, camY + lookY, camZ + lookZ,
-                         x2, y2, z2, &sx2, &sy2, &sz2);
-                project3D(camX, camY, camZ, camX + lookX, camY + lookY, camZ + lookZ,
-                         x3, y3, z3, &sx3, &sy3, &sz3);
-
-                // calcular normales para iluminación
-                float hL = (i > 0) ? precomputedHeights[(i - 1) * gridSize + current_j] : y0;
-                float hR = (i < gridSize - 2) ? precomputedHeights[(i + 2) * gridSize + current_j] : y1;
-                float hD = (current_j > 0) ? precomputedHeights[i * gridSize + (current_j - 1)] : y0;
-                float hU = (current_j < gridSize - 2) ? precomputedHeights[i * gridSize + (current_j + 2)] : y2;
-
-                float nx = hL - hR, ny = 2.0f, nz = hD - hU;
-                float len = sqrtf(nx * nx + ny * ny + nz * nz);
-                if (len > 0.0f) {
-                    nx /= len; ny /= len; nz /= len;
-                }
+    int i = sp->sphere;
+    int radius = sp->radius;
+    int cx = (int)sp->sx, cy = (int)sp->sy;
+    float depth = sp->depth;
+
+    int y0 = cy - radius > minY ? cy - radius : minY;
+    int y1 = cy + radius < maxY - 1 ? cy + radius : maxY - 1;
+
+    // radio 0: un solo punto con z-test y el color ya calculado
+    if(radius < 1){
+        if(cx < minX || cx >= maxX || cy < minY || cy >= maxY) return;
+        int idx = cy*windowWidth + cx;
+        if(depth < zbuffer[idx]){
+            zbuffer[idx] = depth;
+            frameBuffer[idx] = sp->flat;
+        }
+        return;
+    }
+
+    // radios mayores que los sprites calculan la normal por pixel
+    const SphereSprite* spr = radius <= SPRITE_MAX_RADIUS ? &sprites[radius] : NULL;
+    float sr = drawSpheres->color[i].r*255, sg = drawSpheres->color[i].g*255, sb = drawSpheres->color[i].b*255;
+    float wr = drawSpheres->radius[i];
+
+    // luz lejana comparada con el tamaño de la esfera: una sola dirección para todo el disco
+    float lx = lightX - projected.sphereWX[i], ly = lightY - projected.sphereWY[i], lz = lightZ - projected.sphereWZ[i];
+    float dist2 = lx*lx + ly*ly + lz*lz;
+    int directional = wr*wr < SPRITE_DIRECTIONAL*SPRITE_DIRECTIONAL*dist2;
+    if(directional){
+        float inv = 1.0f/sqrtf(dist2);
+        lx *= inv; ly *= inv; lz *= inv;
+    }
 
-                // iluminación difusa
-                float lx = lightX - centerX, ly = lightY - centerY, lz = lightZ - centerZ;
-                float llen = sqrtf(lx * lx + ly * ly + lz * lz);
-                lx /= llen; ly /= llen; lz /= llen;
-
-                float diff = fmaxf(0.0f, nx * lx + ny * ly + nz * lz);
-                float wave = 0.5f + 0.5f * sinf(t * 0.3f + (i + current_j) * 0.05f);
-                
-                Uint8 r = 10;
-                Uint8 g = (Uint8)((50 + 150 * diff) * wave);
-                Uint8 b = (Uint8)((100 + 100 * diff) * (1 - 0.3f * wave));
-                Uint32 color = (r << 16) | (g << 8) | b;
-
-                // dibujar los 2 triángulos del cuadrado
-                drawTriangleClipped(sx0, sy0, sz0, sx1, sy1, sz1, sx2, sy2, sz2, 
-                                  color, minX, maxX, minY, maxY);
-                drawTriangleClipped(sx1, sy1, sz1, sx3, sy3, sz3, sx2, sy2, sz2, 
-                                  color, minX, maxX, minY, maxY);
+    // radios 1..3: lista fija de pixeles, sin cálculo de tramos por fila
+    if(directional && radius <= LOD_MASK_RADIUS){
+        const signed char (*mask)[2] = lodMasks[radius];
+        int inside = cx - radius >= minX && cx + radius < maxX &&
+                     cy - radius >= minY && cy + radius < maxY;
+        for(int m = 0; m < lodMaskCount[radius]; m++){
+            int px = cx + mask[m][0], py = cy + mask[m][1];
+            if(!inside && (px < minX || px >= maxX || py < minY || py >= maxY)) continue;
+            int idx = py*windowWidth + px;
+            if(depth < zbuffer[idx]){
+                zbuffer[idx] = depth;
+                int k = (mask[m][1] + radius)*spr->side + mask[m][0] + radius;
+                float diff = fmaxf(0.0f, spr->nx[k]*lx + spr->ny[k]*ly + spr->nz[k]*lz);
+                Uint8 r = (Uint8)(sr*diff);
+                Uint8 g = (Uint8)(sg*diff);
+                Uint8 b = (Uint8)(sb*diff);
+                frameBuffer[idx] = (r<<16)|(g<<8)|b;
             }
         }
+        return;
     }
 
-    // esferas
-    for(int i=0; i<numSpheres; i++){
-        if(!spheres[i].active) continue;
-
-        float sx,sy,depth;
-        project3D(camX, camY, camZ, camX+lookX, camY+lookY, camZ+lookZ,
-                  spheres[i].x,spheres[i].y,spheres[i].z,&sx,&sy,&depth);
-
-        int radius = (int)(spheres[i].radius * windowWidth / (2*depth+1));
-
-        for(int dy=-radius; dy<=radius; dy++){
-            for(int dx=-radius; dx<=radius; dx++){
-                int px = sx+dx;
-                int py = sy+dy;
-                if(px<minX || px>=maxX || py<minY || py>=maxY) continue;
-                if(dx*dx + dy*dy <= radius*radius){
-                    int idx = py*windowWidth + px;
-                    float z = depth;
-                    if(z < zbuffer[idx]){
-                        zbuffer[idx] = z;
-                        
-                        // calcular iluminación de cada pixel de la esfera
-                        float nx = dx/(float)radius;
-                        float ny = -dy/(float)radius;
-                        float nz = sqrtf(fmaxf(0.0f,1-nx*nx-ny*ny));
-                        float px3D = spheres[i].x + nx*spheres[i].radius;
-                        float py3D = spheres[i].y + ny*spheres[i].radius;
-                        float pz3D = spheres[i].z + nz*spheres[i].radius;
-
-                        float lx = lightX-px3D, ly = lightY-py3D, lz = lightZ-pz3D;
-                        float len = sqrtf(lx*lx+ly*ly+lz*lz);
-                        lx/=len; ly/=len; lz/=len;
-
-                        float diff = fmaxf(0.0f, nx*lx + ny*ly + nz*lz);
-                        Uint8 r = (Uint8)(spheres[i].r*255*diff);
-                        Uint8 g = (Uint8)(spheres[i].g*255*diff);
-                        Uint8 b = (Uint8)(spheres[i].b*255*diff);
-                        frameBuffer[idx] = (r<<16)|(g<<8)|b;
-                    }
+    for(int py=y0; py<=y1; py++){
+        int dy = py - cy;
+        int hw;
+        if(spr) hw = spr->halfWidth[dy + radius];
+        else {
+            hw = (int)sqrtf((float)(radius*radius - dy*dy));
+            while(hw*hw + dy*dy > radius*radius) hw--;
+            while((hw+1)*(hw+1) + dy*dy <= radius*radius) hw++;
+        }
+        int x0 = cx - hw > minX ? cx - hw : minX;
+        int x1 = cx + hw < maxX - 1 ? cx + hw : maxX - 1;
+        int rowBase = spr ? (dy + radius)*spr->side + radius - cx : 0;   // índice del sprite = rowBase + px
+
+        for(int px=x0; px<=x1; px++){
+            int idx = py*windowWidth + px;
+            if(depth < zbuffer[idx]){
+                zbuffer[idx] = depth;
+                float nx, ny, nz;
+                if(spr){
+                    int k = rowBase + px;
+                    nx = spr->nx[k]; ny = spr->ny[k]; nz = spr->nz[k];
+                } else {
+                    nx = (px - cx)/(float)radius;
+                    ny = -dy/(float)radius;
+                    nz = sqrtf(fmaxf(0.0f, 1 - nx*nx - ny*ny));
                 }
+
+                float diff;
+                if(directional){
+                    diff = fmaxf(0.0f, nx*lx + ny*ly + nz*lz);
+                } else {
+                    // luz cercana: vector al punto de la superficie
+                    float plx = lightX - (projected.sphereWX[i] + nx*wr);
+                    float ply = lightY - (projected.sphereWY[i] + ny*wr);
+                    float plz = lightZ - (projected.sphereWZ[i] + nz*wr);
+                    float len = sqrtf(plx*plx + ply*ply + plz*plz);
+                    plx/=len; ply/=len; plz/=len;
+                    diff = fmaxf(0.0f, nx*plx + ny*ply + nz*plz);
+                }
+                Uint8 r = (Uint8)(sr*diff);
+                Uint8 g = (Uint8)(sg*diff);
+                Uint8 b = (Uint8)(sb*diff);
+                frameBuffer[idx] = (r<<16)|(g<<8)|b;
             }
         }
     }
 }
 
 // renderizar escena completa
-void renderScene(SDL_Renderer* renderer,float t,
+void renderScene(SDL_Renderer* renderer,
                  float lightX,float lightY,float lightZ,
-                 float camX,float camY,float camZ,
-                 float lookX,float lookY,float lookZ,
-                float* precomputedHeights)
+                 const Camera* cam,
+                 const Terrain* tr)
 {
-    int numThreads = omp_get_max_threads(); //número de hilos según disponibilidad
+    const ProjectedScene* ps = &projected;
+    const float* heights = terrainHeights(tr);
+    const Uint32* quadColors = terrainColors(tr);
+    int quadsPerRow = gridSize - 1;
+    int numQuads = quadsPerRow * quadsPerRow;
+
+    // cada vértice y cada esfera se proyecta una sola vez
+    stageBegin(STAGE_RASTER_TERRAIN);
+    projectScene(&projected, cam, tr);
+    prepareTileRenderer(&tiles, 4 * numQuads, numSpheres);
+
+    // Pasada del terreno: todo el terreno queda en el z-buffer antes de las esferas
+    #pragma omp parallel
+    {
+        BinList* myTriBins = &tiles.triBins[omp_get_thread_num() * tiles.numTiles];
+
+        // Fase 1: armar los triángulos del terreno y repartirlos en tiles.
+        // Con schedule(static) cada hilo recorre un bloque contiguo, así que al juntar las
+        // listas en orden de hilo se conserva el orden original de dibujo.
+        #pragma omp for schedule(static)
+        for (int q = 0; q < numQuads; q++) {
+            int i = q / quadsPerRow, j = q % quadsPerRow;
+            int v[4] = { i * gridSize + j, (i + 1) * gridSize + j,
+                         i * gridSize + j + 1, (i + 1) * gridSize + j + 1 };
+
+            // distancia al cámara para no dibujar demasiado cerca
+            float dx = (i + 0.5f) * SCALE - cam->x;
+            float dy = (heights[v[0]] + heights[v[1]] + heights[v[2]] + heights[v[3]]) * 0.25f - cam->y;
+            float dz = (j + 0.5f) * SCALE - cam->z;
+            if (dx * dx + dy * dy + dz * dz < 1.0f) continue;
+
+            // fuera del volumen de vista: los 4 vértices del mismo lado de un plano
+            Uint8 quadOut = ps->terrainOut[v[0]] & ps->terrainOut[v[1]] &
+                            ps->terrainOut[v[2]] & ps->terrainOut[v[3]];
+            if (quadOut) continue;
+
+            // los 2 triángulos del cuadrado: (v0,v1,v2) y (v1,v3,v2); cada uno tiene
+            // 2 lugares en tiles.tris por si el recorte cercano lo parte en dos
+            static const int corners[2][3] = { {0, 1, 2}, {1, 3, 2} };
+            for (int h = 0; h < 2; h++) {
+                int tv[3] = { v[corners[h][0]], v[corners[h][1]], v[corners[h][2]] };
+                Uint8 andOut = ps->terrainOut[tv[0]] & ps->terrainOut[tv[1]] & ps->terrainOut[tv[2]];
+                Uint8 orOut = ps->terrainOut[tv[0]] | ps->terrainOut[tv[1]] | ps->terrainOut[tv[2]];
+                if (andOut) continue;
+
+                if (!(orOut & CLIP_NEAR)) {
+                    binTriangle(&tiles, myTriBins, 4*q + 2*h, ps->terrainX, ps->terrainY,
+                                ps->terrainDepth, tv, quadColors[q]);
+                    continue;
+                }
 
-    // dividir la pantalla en cuadrantes
-    int nCols = 2;  // Empezar con 2 columnas
-    int nRows = omp_get_max_threads() / nCols;
-    if (nRows * nCols < omp_get_max_threads()) nRows++;
+                // cruza el plano cercano: recortar en coordenadas de recorte y proyectar
+                float clip[3][3], px[4], py[4], pz[4];
+                for (int c = 0; c < 3; c++)
+                    clipPoint(cam, (tv[c] / gridSize) * SCALE, heights[tv[c]],
+                              (tv[c] % gridSize) * SCALE, clip[c]);
+                int n = clipTriangleNear(clip, px, py, pz);
+                for (int f = 0; f + 2 < n; f++) {
+                    int fan[3] = { 0, f + 1, f + 2 };
+                    binTriangle(&tiles, myTriBins, 4*q + 2*h + f, px, py, pz, fan,
+                                quadColors[q]);
+                }
+            }
+        }
+
+        // Fase 2: cada hilo toma el siguiente tile libre, lo limpia y dibuja sus triángulos.
+        // La limpieza va aquí y no en una pasada aparte sobre todo el frame: el tile
+        // queda en la caché del hilo que lo va a dibujar.
+        #pragma omp for schedule(dynamic, 1)
+        for (int tile = 0; tile < tiles.numTiles; tile++) {
+            int minX = (tile % tiles.tilesX) * TILE_SIZE;
+            int minY = (tile / tiles.tilesX) * TILE_SIZE;
+            int maxX = minX + TILE_SIZE < windowWidth ? minX + TILE_SIZE : windowWidth;
+            int maxY = minY + TILE_SIZE < windowHeight ? minY + TILE_SIZE : windowHeight;
+
+            for (int y = minY; y < maxY; y++)
+                clearSpan(&frameBuffer[y * windowWidth + minX], &zbuffer[y * windowWidth + minX],
+                          maxX - minX, 0);
+
+            for (int th = 0; th < tiles.numThreads; th++) {
+                const BinList* bin = &tiles.triBins[th * tiles.numTiles + tile];
+                for (int k = 0; k < bin->count; k++) {
+                    const TriSetup* tri = &tiles.tris[bin->items[k]];
+                    drawTriangleClipped(tri->x[0], tri->y[0], tri->z[0],
+                                        tri->x[1], tri->y[1], tri->z[1],
+                                        tri->x[2], tri->y[2], tri->z[2],
+                                        tri->color, minX, maxX, minY, maxY);
+                }
+            }
 
-    // Paralelizar por cuadrantes de pantalla
-    #pragma omp parallel for collapse(2) schedule(static, 1)
-    for(int row=0; row<nRows; row++){
-        for(int col=0; col<nCols; col++){
-            int tid = row*nCols + col;
-            if(tid >= numThreads) continue; // si hay más cuadrantes que hilos
+            buildTileHiZ(&tiles, minX, maxX, minY, maxY);
+        }
+    }
+    stageEnd(STAGE_RASTER_TERRAIN);
 
-            int minX = col * windowWidth / nCols;
-            int maxX = (col+1) * windowWidth / nCols;
-            int minY = row * windowHeight / nRows;
-            int maxY = (row+1) * windowHeight / nRows;
+    // Pasada de las esferas, con el mismo reparto por tiles
+    stageBegin(STAGE_SPLAT_SPHERES);
+    #pragma omp parallel
+    {
+        BinList* mySplatBins = &tiles.splatBins[omp_get_thread_num() * tiles.numTiles];
+
+        #pragma omp for schedule(static)
+        for (int i = 0; i < drawSpheres->count; i++) {
+            // el centro detrás del plano cercano no tiene proyección válida
+            if (ps->sphereOut[i] & CLIP_NEAR) continue;
+            SphereSplat* sp = &tiles.splats[i];
+            sp->sx = ps->sphereX[i];
+            sp->sy = ps->sphereY[i];
+            sp->depth = ps->sphereDepth[i];
+            sp->radius = (int)(drawSpheres->radius[i] * windowWidth / (2*sp->depth+1));
+            sp->sphere = i;
+            if (sp->radius < 1) sp->flat = sphereFlatColor(i, lightX, lightY, lightZ);
+            int cx = (int)sp->sx, cy = (int)sp->sy;
+
+            // esferas tapadas por el terreno no llegan a ningún tile
+            if (splatOccluded(&tiles, sp->depth, cx - sp->radius, cx + sp->radius,
+                              cy - sp->radius, cy + sp->radius)) continue;
+            binRect(&tiles, mySplatBins, i, cx - sp->radius, cx + sp->radius,
+                    cy - sp->radius, cy + sp->radius);
+        }
 
-            // renderizar cada cuadrante en paralelo
-            renderSceneQuadrant(minX, maxX, minY, maxY,
-                                renderer, t,
-                                lightX, lightY, lightZ,
-                                camX, camY, camZ,
-                                lookX, lookY, lookZ,
-                            precomputedHeights);
+        #pragma omp for schedule(dynamic, 1)
+        for (int tile = 0; tile < tiles.numTiles; tile++) {
+            int minX = (tile % tiles.tilesX) * TILE_SIZE;
+            int minY = (tile / tiles.tilesX) * TILE_SIZE;
+            int maxX = minX + TILE_SIZE < windowWidth ? minX + TILE_SIZE : windowWidth;
+            int maxY = minY + TILE_SIZE < windowHeight ? minY + TILE_SIZE : windowHeight;
+
+            for (int th = 0; th < tiles.numThreads; th++) {
+                const BinList* bin = &tiles.splatBins[th * tiles.numTiles + tile];
+                for (int k = 0; k < bin->count; k++) {
+                    drawSphereSplat(&tiles.splats[bin->items[k]],
+                                    lightX, lightY, lightZ, minX, maxX, minY, maxY);
+                }
+            }
         }
     }
+    stageEnd(STAGE_SPLAT_SPHERES);
 }
 
-// Actualizar posición de la cámara según el modo elegido
-void updateCameraView(int viewMode, float centerX,float centerZ,float radius,float *camX,float *camY,float *camZ,
-                      float *lookX,float *lookY,float *lookZ,float *yaw){
+// Actualizar posición de la cámara según el modo elegido y construir su matriz de vista
+void updateCameraView(int viewMode, float centerX,float centerZ,float radius,float *yaw,Camera* cam){
+    float camX, camY, camZ;
+    float lookX, lookY, lookZ;
     switch(viewMode){
         case 1: // Rotando alrededor del centro
             *yaw += 0.01f;
-            *camX = centerX + radius*sinf(*yaw);
-            *camZ = centerZ + radius*cosf(*yaw);
-            *camY = 10.0f;
-            *lookX = centerX - *camX;
-            *lookY = -(*camY);
-            *lookZ = centerZ - *camZ;
+            camX = centerX + radius*sinf(*yaw);
+            camZ = centerZ + radius*cosf(*yaw);
+            camY = 10.0f;
+            lookX = centerX - camX;
+            lookY = -camY;
+            lookZ = centerZ - camZ;
             break;
         case 2: // Vista desde el cielo
-            *camX = centerX - 20.0f;    // Posicionada a la izquierda
-            *camY = 35.0f;              // Alta enough para ver todo
-            *camZ = centerZ - 20.0f;    // Posicionada atrás
+            camX = centerX - 20.0f;    // Posicionada a la izquierda
+            camY = 35.0f;              // Alta enough para ver todo
+            camZ = centerZ - 20.0f;    // Posicionada atrás
             
             // Mirar hacia el centro del terreno con ángulo oblicuo
-            *lookX = centerX - *camX;
-            *lookY = 5.0f - *camY;      // Mirar ligeramente hacia abajo
-            *lookZ = centerZ - *camZ;
+            lookX = centerX - camX;
+            lookY = 5.0f - camY;      // Mirar ligeramente hacia abajo
+            lookZ = centerZ - camZ;
             break;
         case 3: // Vista lateral fija
-            *camX = -20.0f;
-            *camY = 10.0f;
-            *camZ = centerZ;
-            *lookX = centerX + 20.0f; // mirar al centro
-            *lookY = -(*camY);
-            *lookZ = centerZ - *camZ;
+            camX = -20.0f;
+            camY = 10.0f;
+            camZ = centerZ;
+            lookX = centerX + 20.0f; // mirar al centro
+            lookY = -camY;
+            lookZ = centerZ - camZ;
             break;
         default: // fallback
-            *camX = centerX + radius*sinf(*yaw);
-            *camZ = centerZ + radius*cosf(*yaw);
-            *camY = 15.0f;
-            *lookX = centerX - *camX;
-            *lookY = -(*camY);
-            *lookZ = centerZ - *camZ;
+            camX = centerX + radius*sinf(*yaw);
+            camZ = centerZ + radius*cosf(*yaw);
+            camY = 15.0f;
+            lookX = centerX - camX;
+            lookY = -camY;
+            lookZ = centerZ - camZ;
             break;
     }
+    setCameraLookAt(cam, camX, camY, camZ, lookX, lookY, lookZ);
 }
 
-int main(int argc, char* argv[]){
-    if(argc>1) numSpheres=atoi(argv[1]);
-    if(numSpheres<=0) numSpheres=DEF_SPHERES;
+// ===== Log de FPS asíncrono =====
+// El hilo del frame solo copia un registro a un buffer circular (un productor, un
+// consumidor); un hilo aparte lo vacía al archivo. Si el buffer se llena el registro
+// se descarta y se cuenta, nunca se bloquea el frame.
+#define METRICS_RING_SIZE 4096      // potencia de 2
+#define METRICS_DRAIN_MS 10         // espera del escritor cuando no hay registros
 
-    if(argc>2) gridSize=atof(argv[2]);
-    if (gridSize<GRID_SIZE) gridSize=GRID_SIZE;
+typedef struct {
+    float fps;
+} MetricRecord;
 
-    FILE* logFile = fopen("fps_log_paralelo.txt", "w");
+typedef struct {
+    MetricRecord records[METRICS_RING_SIZE];
+    SDL_atomic_t head;      // próximo registro a escribir (solo el hilo del frame)
+    SDL_atomic_t tail;      // próximo registro a leer (solo el hilo escritor)
+    SDL_atomic_t running;
+    SDL_atomic_t dropped;   // registros descartados por buffer lleno
+    Uint64 written;         // registros escritos al archivo
+    int maxPending;         // máximo de registros en espera observado por el escritor
+    FILE* file;
+    SDL_Thread* thread;
+} MetricsLog;
+
+MetricsLog metricsLog;
+
+static int metricsWriter(void* data){
+    MetricsLog* log = (MetricsLog*)data;
+    for(;;){
+        int running = SDL_AtomicGet(&log->running);
+        unsigned int tail = (unsigned int)SDL_AtomicGet(&log->tail);
+        unsigned int head = (unsigned int)SDL_AtomicGet(&log->head);
+        SDL_MemoryBarrierAcquire();
+
+        int pending = (int)(head - tail);
+        if(pending > log->maxPending) log->maxPending = pending;
+        for(; tail != head; tail++)
+            fprintf(log->file, "%.2f\n", log->records[tail & (METRICS_RING_SIZE-1)].fps);
+        log->written += pending;
+        SDL_AtomicSet(&log->tail, (int)tail);
+
+        if(pending > 0) fflush(log->file);
+        else if(!running) break;    // ya se vació todo lo que dejó el frame
+        else SDL_Delay(METRICS_DRAIN_MS);
+    }
+    return 0;
+}
 
-    SDL_Init(SDL_INIT_VIDEO);
-    SDL_Window* window = SDL_CreateWindow("Olas - SDL Texture",
-        SDL_WINDOWPOS_CENTERED,SDL_WINDOWPOS_CENTERED,
-        windowWidth,windowHeight,SDL_WINDOW_SHOWN);
-    SDL_Renderer* renderer = SDL_CreateRenderer(window,-1,SDL_RENDERER_ACCELERATED);
+int metricsLogOpen(MetricsLog* log, const char* path){
+    memset(log, 0, sizeof(*log));
+    log->file = fopen(path, "w");
+    if(!log->file) return 0;
+    SDL_AtomicSet(&log->running, 1);
+    log->thread = SDL_CreateThread(metricsWriter, "metricsWriter", log);
+    if(!log->thread){
+        fclose(log->file);
+        log->file = NULL;
+        return 0;
+    }
+    return 1;
+}
 
-    // inicializar textura y buffers persistentes
-    screenTexture = SDL_CreateTexture(renderer, 
-        SDL_PIXELFORMAT_ARGB8888, 
-        SDL_TEXTUREACCESS_STREAMING,
-        windowWidth, windowHeight);
+// Llamado desde el hilo del frame: nunca espera
+static inline void metricsLogPush(MetricsLog* log, float fps){
+    if(!log->thread) return;
+    unsigned int head = (unsigned int)SDL_AtomicGet(&log->head);
+    unsigned int tail = (unsigned int)SDL_AtomicGet(&log->tail);
+    if(head - tail >= METRICS_RING_SIZE){
+        SDL_AtomicAdd(&log->dropped, 1);
+        return;
+    }
+    log->records[head & (METRICS_RING_SIZE-1)].fps = fps;
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&log->head, (int)(head + 1));
+}
+
+void metricsLogClose(MetricsLog* log){
+    if(!log->thread) return;
+    SDL_AtomicSet(&log->running, 0);
+    SDL_WaitThread(log->thread, NULL);
+    log->thread = NULL;
+    fclose(log->file);
+    log->file = NULL;
+    printf("Log de FPS: %llu escritos, %d descartados, máximo en espera %d de %d\n",
+           (unsigned long long)log->written, SDL_AtomicGet(&log->dropped),
+           log->maxPending, METRICS_RING_SIZE);
+}
+
+// Hash FNV-1a del framebuffer: dos corridas con la misma semilla deben dar el mismo valor
+Uint32 frameHash(void){
+    Uint32 h = 2166136261u;
+    const unsigned char* bytes = (const unsigned char*)frameBuffer;
+    size_t n = (size_t)windowWidth*windowHeight*sizeof(Uint32);
+    for(size_t i=0;i<n;i++){
+        h ^= bytes[i];
+        h *= 16777619u;
+    }
+    return h;
+}
+
+// ===== Física en paralelo con el render =====
+// Un hilo de física avanza el frame N+1 mientras el hilo principal rasteriza y presenta el
+// frame N. Cada pedido lleva los pasos y esferas nuevas del frame; al terminar, la física
+// copia el estado a la instantánea libre y avisa. El render siempre dibuja la instantánea
+// anterior, así que va un frame detrás de la física.
+typedef struct {
+    SDL_Thread* thread;
+    SDL_sem* request;       // principal -> física: hay un pedido
+    SDL_sem* ready;         // física -> principal: la instantánea del pedido está lista
+    int threads;            // hilos OpenMP de la física (el resto es del render)
+    int quit;
+
+    // pedido en curso; solo se escribe mientras la física espera
+    int steps;
+    int spawn;
+    float alpha;
+    int target;             // instantánea que escribe la física
+
+    // reloj de la física
+    float stepScale;
+    float t;                // tiempo de la ola del próximo paso
+    float stepT, prevStepT; // tiempo del último paso y del anterior
+    int framesSinceReorder;
+    float lightX, lightY, lightZ;   // luz con la que se sombrea el terreno
+} PhysicsPipeline;
+
+PhysicsPipeline pipeline = {0};
+
+static int physicsThread(void* data){
+    PhysicsPipeline* pl = (PhysicsPipeline*)data;
+    omp_set_num_threads(pl->threads);   // el equipo de este hilo es independiente del render
+
+    for(;;){
+        SDL_SemWait(pl->request);
+        if(pl->quit) break;
+
+        stageBegin(STAGE_SPAWN);
+        for(int k=0; k<pl->spawn && spheres.activeCount<numSpheres; k++){
+            activateSphere(spheres.idOf[spheres.activeCount]);
+        }
+        stageEnd(STAGE_SPAWN);
+
+        for(int k=0; k<pl->steps; k++){
+            updatePhysics(pl->t, pl->stepScale);   // mide integrar y colisiones por dentro
+            pl->prevStepT = pl->stepT;
+            pl->stepT = pl->t;
+            pl->t += WAVE_TIME_STEP*pl->stepScale;
+        }
+
+        if(reorderFrames > 0 && ++pl->framesSinceReorder >= reorderFrames){
+            pl->framesSinceReorder = 0;
+            stageBegin(STAGE_REORDER);
+            reorderSpheres();
+            stageEnd(STAGE_REORDER);
+        }
+
+        stageBegin(STAGE_SNAPSHOT);
+        SphereSnapshot* sn = &snapshots[pl->target];
+        takeSnapshot(sn);
+        sn->alpha = pl->alpha;
+        sn->renderT = pl->prevStepT + pl->alpha*(pl->stepT - pl->prevStepT);
+        stageEnd(STAGE_SNAPSHOT);
+
+        // terreno de la instantánea en el buffer siguiente, mientras el render dibuja el actual
+        stageBegin(STAGE_TERRAIN);
+        buildTerrainHeights(&terrain, sn->renderT);
+        shadeTerrain(&terrain, sn->renderT, pl->lightX, pl->lightY, pl->lightZ);
+        stageEnd(STAGE_TERRAIN);
+
+        SDL_SemPost(pl->ready);
+    }
+    return 0;
+}
+
+// Pedir el próximo frame a la física; solo se llama con la física esperando
+void pipelineSubmit(PhysicsPipeline* pl, int steps, int spawn, float alpha){
+    pl->steps = steps;
+    pl->spawn = spawn;
+    pl->alpha = alpha;
+    SDL_SemPost(pl->request);
+}
+
+// Esperar el pedido en curso y devolver su instantánea; su terreno pasa a ser el actual y
+// la siguiente se escribe en la otra
+const SphereSnapshot* pipelineWait(PhysicsPipeline* pl){
+    SDL_SemWait(pl->ready);
+    const SphereSnapshot* sn = &snapshots[pl->target];
+    pl->target ^= 1;
+    swapTerrain(&terrain);
+    return sn;
+}
+
+// Repartir los hilos entre física y render, arrancar el hilo y publicar el estado inicial.
+// El terreno ya tiene que estar reservado: la física lo arma y el render lo lee
+void pipelineStart(PhysicsPipeline* pl, float stepScale, float lightX, float lightY, float lightZ){
+    int total = omp_get_max_threads();
+    pl->threads = total/2 > 0 ? total/2 : 1;
+    omp_set_num_threads(total - pl->threads > 0 ? total - pl->threads : 1);
+    pl->stepScale = stepScale;
+    pl->lightX = lightX;
+    pl->lightY = lightY;
+    pl->lightZ = lightZ;
+    pl->request = SDL_CreateSemaphore(0);
+    pl->ready = SDL_CreateSemaphore(0);
+    pl->thread = SDL_CreateThread(physicsThread, "physics", pl);
+    pipelineSubmit(pl, 0, 0, 1.0f);
+}
+
+// Esperar el último pedido y terminar el hilo
+void pipelineStop(PhysicsPipeline* pl){
+    SDL_SemWait(pl->ready);
+    pl->quit = 1;
+    SDL_SemPost(pl->request);
+    SDL_WaitThread(pl->thread, NULL);
+    SDL_DestroySemaphore(pl->request);
+    SDL_DestroySemaphore(pl->ready);
+    freeSnapshot(&snapshots[0]);
+    freeSnapshot(&snapshots[1]);
+}
+
+// Línea de uso; se imprime ante un argumento inválido
+void printUsage(const char* prog){
+    printf("Uso: %s [esferas] [grid] [--headless] [--frames N] [--seed S] [--physics-hz H] "
+           "[--broadphase grid|sap] [--reorder K] [--contact-iters N]\n", prog);
+}
+
+int main(int argc, char* argv[]){
+    // Argumentos: [esferas] [grid] [--headless] [--frames N] [--seed S] [--physics-hz H] [--broadphase grid|sap] [--reorder K] [--contact-iters N]
+    int headless = 0;
+    int maxFrames = 0;  // 0 = sin límite
+    int physicsHz = PHYSICS_BASE_HZ;
+    unsigned int seed = (unsigned int)time(NULL);
+    int positional = 0;
+    for(int a=1;a<argc;a++){
+        if(strcmp(argv[a],"--headless")==0) headless=1;
+        else if(strcmp(argv[a],"--frames")==0 && a+1<argc) maxFrames=atoi(argv[++a]);
+        else if(strcmp(argv[a],"--seed")==0 && a+1<argc) seed=(unsigned int)strtoul(argv[++a],NULL,10);
+        else if(strcmp(argv[a],"--physics-hz")==0 && a+1<argc) physicsHz=atoi(argv[++a]);
+        else if(strcmp(argv[a],"--reorder")==0 && a+1<argc) reorderFrames=atoi(argv[++a]);
+        else if(strcmp(argv[a],"--contact-iters")==0 && a+1<argc){
+            // al menos una iteración: sin solver no se separa ningún par
+            char* end;
+            long iters = strtol(argv[++a], &end, 10);
+            if(*end!='\0' || iters<1 || iters>INT_MAX){
+                printf("Iteraciones de contacto inválidas: %s\n", argv[a]);
+                printUsage(argv[0]);
+                return 1;
+            }
+            contactIterations = (int)iters;
+        }
+        else if(strcmp(argv[a],"--broadphase")==0 && a+1<argc){
+            a++;
+            if(strcmp(argv[a],"sap")==0) broadphase=BROADPHASE_SAP;
+            else if(strcmp(argv[a],"grid")==0) broadphase=BROADPHASE_GRID;
+            else {
+                printf("Fase amplia desconocida: %s\n", argv[a]);
+                printUsage(argv[0]);
+                return 1;
+            }
+        }
+        else if(strncmp(argv[a],"--",2)==0){
+            // opción desconocida o sin su valor: mejor avisar que correr con los valores por defecto
+            printf("Opción no reconocida: %s\n", argv[a]);
+            printUsage(argv[0]);
+            return 1;
+        }
+        else if(positional==0){ numSpheres=atoi(argv[a]); positional++; }
+        else if(positional==1){ gridSize=atof(argv[a]); positional++; }
+    }
+    if(numSpheres<=0) numSpheres=DEF_SPHERES;
+    if (gridSize<GRID_SIZE) gridSize=GRID_SIZE;
+    if(headless && maxFrames<=0) maxFrames=DEF_HEADLESS_FRAMES;
+    if(physicsHz<=0) physicsHz=PHYSICS_BASE_HZ;
+
+    // En headless no se crea ventana: se renderiza solo al framebuffer
+    SDL_Window* window = NULL;
+    SDL_Renderer* renderer = NULL;
+    if(headless){
+        SDL_Init(SDL_INIT_TIMER);
+    } else {
+        SDL_Init(SDL_INIT_VIDEO);
+        window = SDL_CreateWindow("Olas - SDL Texture",
+            SDL_WINDOWPOS_CENTERED,SDL_WINDOWPOS_CENTERED,
+            windowWidth,windowHeight,SDL_WINDOW_SHOWN);
+        renderer = SDL_CreateRenderer(window,-1,SDL_RENDERER_ACCELERATED);
+
+        // inicializar textura y buffers persistentes
+        screenTexture = SDL_CreateTexture(renderer, 
+            SDL_PIXELFORMAT_ARGB8888, 
+            SDL_TEXTUREACCESS_STREAMING,
+            windowWidth, windowHeight);
+    }
     
+    // el archivo de FPS lo escribe un hilo aparte
+    metricsLogOpen(&metricsLog, "fps_log_paralelo.txt");
+
     initRenderBuffers();  // Crear buffers una sola vez
-    initSpheres(numSpheres);
+    initSphereSprites();
+    clearRenderBuffers();
+    initSpheres(numSpheres, seed);
 
     float centerX = gridSize*SCALE/2;
     float centerZ = gridSize*SCALE/2;
     float radius = 10.0f;
     float yaw = 0.0f;
-    float camX, camY, camZ;
-    float lookX, lookY, lookZ;
 
     float lightX = centerX + 30.0f;
     float lightY = 25.0f;
@@ -507,17 +2808,28 @@ int main(int argc, char* argv[]){
 
     int running = 1;
     SDL_Event event;
-    float t=0;
-    Uint32 lastTime = SDL_GetTicks();
-    Uint32 lastSpawn = lastTime;
-    int spawned = 0;
+    // Paso fijo: el reloj de pared llena un acumulador y se corren los pasos que quepan.
+    // En headless el reloj es simulado (un frame = un paso base) para que sea reproducible
+    double stepSeconds = 1.0/physicsHz;
+    float stepScale = (float)PHYSICS_BASE_HZ/physicsHz;  // paso en pasos base
+    double accumulator = 0.0;
+    Uint32 lastSpawn = SDL_GetTicks();
+    Uint64 lastCounter = SDL_GetPerformanceCounter();  // resolución fina: en headless un frame puede durar < 1 ms
+    if(headless){
+        // headless: todas desde el inicio
+        for(int i=0;i<numSpheres;i++) activateSphere(i);
+    }
+    ensureTerrain(&terrain, gridSize);
+    pipelineStart(&pipeline, stepScale, lightX, lightY, lightZ);
+    int frames = 0;
+    Uint64 runStart = SDL_GetPerformanceCounter();
 
     int viewMode = 1; // Inicio con cámara rotando
 
     char title[128];  // Buffer para el título de la ventana
 
     while(running){
-        while(SDL_PollEvent(&event)){ // atento a acciones del usuario
+        while(!headless && SDL_PollEvent(&event)){ // atento a acciones del usuario
             if(event.type==SDL_QUIT) running=0;
             if(event.type==SDL_KEYDOWN){
                 if(event.key.keysym.sym==SDLK_1) viewMode=1;
@@ -531,62 +2843,101 @@ int main(int argc, char* argv[]){
             }
         }
 
+        stageBegin(STAGE_FRAME);  // trabajo del frame, sin contar el SDL_Delay
         Uint32 now = SDL_GetTicks();
-        float deltaTime = (now - lastTime)/1000.0f;
-        lastTime = now;
-
-        if(now - lastSpawn >= SPAWN_INTERVAL && spawned<numSpheres){
-            spheres[spawned].active=1;
-            spawned++;
-            lastSpawn=now;
-        }
-
-        updateCameraView(viewMode, centerX, centerZ, radius, &camX,&camY,&camZ, &lookX,&lookY,&lookZ, &yaw);
-        updatePhysics(t);
-        resetZBuffer();
-
-        SDL_SetRenderDrawColor(renderer,0,0,0,255);
-        SDL_RenderClear(renderer);
-
-        // calculo de alturas, para evitar recalcular múltiples veces
-        float* precomputedHeights = malloc(gridSize * gridSize * sizeof(float));
-        #pragma omp parallel for collapse(2)
-        for(int i = 0; i < gridSize; i++) {
-            for(int j = 0; j < gridSize; j++) {
-                float x = i * SCALE;
-                float z = j * SCALE;
-                precomputedHeights[i * gridSize + j] = waveHeight(x, z, t);
-            }
+        Uint64 counter = SDL_GetPerformanceCounter();
+        float deltaTime = (float)(counter - lastCounter)/SDL_GetPerformanceFrequency();
+        lastCounter = counter;
+
+        // una esfera por cada SPAWN_INTERVAL transcurrido, aunque el frame dure más;
+        // las activa la física al recibir el pedido
+        int spawn = 0;
+        if(now - lastSpawn >= SPAWN_INTERVAL){
+            Uint32 due = (now - lastSpawn) / SPAWN_INTERVAL;
+            spawn = due < (Uint32)numSpheres ? (int)due : numSpheres;
+            lastSpawn += due * SPAWN_INTERVAL;
         }
 
-        renderScene(renderer,t,lightX,lightY,lightZ,
-                    camX,camY,camZ,lookX,lookY,lookZ,
-                    precomputedHeights);
+        stageBegin(STAGE_CAMERA);
+        updateCameraView(viewMode, centerX, centerZ, radius, &yaw, &camera);
+        stageEnd(STAGE_CAMERA);
 
-        free(precomputedHeights);
+        // 0..MAX_PHYSICS_STEPS pasos según el tiempo transcurrido
+        accumulator += headless ? 1.0/PHYSICS_BASE_HZ : deltaTime;
+        int steps = 0;
+        while(accumulator >= stepSeconds && steps < MAX_PHYSICS_STEPS){
+            accumulator -= stepSeconds;
+            steps++;
+        }
+        if(accumulator >= stepSeconds) accumulator = 0.0;   // atraso imposible de recuperar: se descarta
+
+        // tomar el frame que terminó la física y pedirle el siguiente; se dibuja entre sus
+        // dos últimos pasos, según lo que sobra del acumulador
+        stageBegin(STAGE_PHYSICS_WAIT);
+        drawSpheres = pipelineWait(&pipeline);
+        stageEnd(STAGE_PHYSICS_WAIT);
+        pipelineSubmit(&pipeline, steps, spawn, (float)(accumulator/stepSeconds));
+
+        // framebuffer y z-buffer se limpian por tile dentro de renderScene
+        stageBegin(STAGE_CLEAR);
+        if(!headless){
+            SDL_SetRenderDrawColor(renderer,0,0,0,255);
+            SDL_RenderClear(renderer);
+        }
+        stageEnd(STAGE_CLEAR);
+
+        renderScene(renderer,lightX,lightY,lightZ,
+                    &camera, &terrain);   // mide raster del terreno y esferas por dentro
 
-        // Actualizar textura con el framebuffer
-        SDL_UpdateTexture(screenTexture, NULL, frameBuffer, windowWidth * sizeof(Uint32));
-        SDL_RenderCopy(renderer, screenTexture, NULL, NULL);
+        if(!headless){
+            // Actualizar textura con el framebuffer
+            stageBegin(STAGE_UPLOAD);
+            SDL_UpdateTexture(screenTexture, NULL, frameBuffer, windowWidth * sizeof(Uint32));
+            SDL_RenderCopy(renderer, screenTexture, NULL, NULL);
+            stageEnd(STAGE_UPLOAD);
 
-        SDL_RenderPresent(renderer);
+            stageBegin(STAGE_PRESENT);
+            SDL_RenderPresent(renderer);
+            stageEnd(STAGE_PRESENT);
+        }
 
         // Cálculo y mostrar FPS en el título
         float fps = 1.0f / deltaTime;
-        fprintf(logFile, "%.2f\n", fps);
-        fflush(logFile);
-        sprintf(title, "Olas PARALELO - FPS: %.2f - Esferas: %d", fps, spawned);
-        SDL_SetWindowTitle(window, title);
+        metricsLogPush(&metricsLog, fps);
+        stageEnd(STAGE_FRAME);
+        if(!headless){
+            sprintf(title, "Olas PARALELO - FPS: %.2f - Esferas: %d (dormidas: %d)", fps,
+                    drawSpheres->count, drawSpheres->sleeping);
+            SDL_SetWindowTitle(window, title);
+            SDL_Delay(16);  // Limitar a ~60 FPS
+        }
 
-        SDL_Delay(16);  // Limitar a ~60 FPS
-        t += 0.05f;     // Avanzar tiempo de animación
+        frames++;
+        if(maxFrames>0 && frames>=maxFrames) running=0;
     }
 
-    fclose(logFile);
+    double wallSeconds = (double)(SDL_GetPerformanceCounter()-runStart)/SDL_GetPerformanceFrequency();
+    if(frames>0) printf("Frames: %d  Tiempo: %.3f s  FPS promedio: %.2f\n", frames, wallSeconds, frames/wallSeconds);
+    pipelineStop(&pipeline);   // el último pedido queda sin dibujar
+    printf("Esferas dormidas: %d de %d\n", spheres.activeCount - spheres.awakeCount, spheres.activeCount);
+    printf("Fase amplia: %s\n", broadphase == BROADPHASE_SAP ? "sap" : "grid");
+    dumpStageStats("stage_times_paralelo", frames);
+    printf("Hash framebuffer: %08x\n", frameHash());
+
+    metricsLogClose(&metricsLog);
     freeRenderBuffers();
+    freeGrid();
+    freeSweep();
+    freeReorder();
+    freeContacts();
+    freeSpheres();
+    freeTerrain(&terrain);
+    freeProjectedScene(&projected);
+    freeTileRenderer(&tiles);
+    freeSphereSprites();
     if(screenTexture) SDL_DestroyTexture(screenTexture);
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
+    if(renderer) SDL_DestroyRenderer(renderer);
+    if(window) SDL_DestroyWindow(window);
     SDL_Quit();
     return 0;
 }
\ No newline at end of file
@@ -1,24 +1,47 @@
 #include <SDL2/SDL.h>
+#include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
 #include <math.h>
 #include <time.h>
+#include <stdint.h>
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define GRID_SIZE 40
 #define SCALE 1.0f
 #define DEF_SPHERES 10000
 #define GRAVITY -0.02f
 #define BOUNCE 0.7f
+#define GROUND_FRICTION 0.7f    // Fraccion de la velocidad horizontal que queda al tocar el piso
+#define GROUND_STICK 0.1f       // Por debajo de esta velocidad contra el piso no rebota
 #define SPAWN_INTERVAL 1
+#define DEF_HEADLESS_FRAMES 600
+
+// Fisica con paso fijo: las constantes por paso (GRAVITY, velocidades, tiempo de ola)
+// estan en unidades de un paso a PHYSICS_BASE_HZ; a otra frecuencia se escalan por el paso
+#define PHYSICS_BASE_HZ 60
+#define MAX_PHYSICS_STEPS 8     // Pasos por frame como maximo; el resto del atraso se descarta
+#define WAVE_TIME_STEP 0.05f    // Avance del tiempo de la ola por paso base
+#define RENDER_ALIGN 64
+#define PROJECT_BLOCK 256   // Puntos del terreno por llamada a projectPoints
+#define DEPTH_CLEAR 1e30f   // Profundidad de un pixel vacío
 
 typedef struct {
     float x, y, z; // posición
     float vx, vy, vz; // velocidades
+    float px, py, pz; // posicion al inicio del ultimo paso (para interpolar)
     float radius;
+    float floorY; // altura del piso en el paso anterior (para su velocidad)
     float r, g, b; // color
-    int active; 
 } Sphere;
 
+// Las esferas activas quedan compactas en spheres[0, activeCount)
 Sphere spheres[DEF_SPHERES];
+int activeCount = 0;
+int sphereSlot[DEF_SPHERES];  // Id estable -> posicion en spheres[]
+int sphereId[DEF_SPHERES];    // Posicion -> id estable
 
 // Variables Globales
 int numSpheres = 1;
@@ -33,6 +56,105 @@ SDL_Texture* screenTexture = NULL;
 Uint32* frameBuffer = NULL;
 float* zbuffer = NULL;
 
+// ===== Instrumentación por etapa =====
+// Cada etapa del frame se mide con stageBegin/stageEnd (contador monotónico de SDL)
+// y se acumula en un histograma logarítmico para sacar p50/p95/p99 al salir.
+enum {
+    STAGE_SPAWN, STAGE_CAMERA, STAGE_INTEGRATE, STAGE_COLLIDE, STAGE_TERRAIN, STAGE_CLEAR,
+    STAGE_RASTER_TERRAIN, STAGE_SPLAT_SPHERES, STAGE_UPLOAD, STAGE_PRESENT, STAGE_FRAME,
+    NUM_STAGES
+};
+static const char* stageNames[NUM_STAGES] = {
+    "spawn", "camara", "integrar", "colisiones", "terreno", "limpieza",
+    "raster_terreno", "esferas", "subir_textura", "presentar", "frame"
+};
+
+// 8 cubetas por cada potencia de 2 de microsegundos (error relativo < 7%), hasta ~16 s
+#define HIST_SUB 8
+#define HIST_OCTAVES 24
+#define HIST_BUCKETS (HIST_SUB * HIST_OCTAVES)
+
+typedef struct {
+    Uint64 start;           // contador al entrar a la etapa
+    Uint64 count;
+    double totalMs, maxMs;
+    Uint32 hist[HIST_BUCKETS];
+} StageStats;
+
+StageStats stageStats[NUM_STAGES];
+
+static inline void stageBegin(int stage) {
+    stageStats[stage].start = SDL_GetPerformanceCounter();
+}
+
+// Cubeta de un tiempo en microsegundos: exponente y subdivisión lineal de la mantisa
+static inline int histBucket(double us) {
+    if (us < 1.0) return 0;
+    int e;
+    double m = frexp(us, &e);   // us = m * 2^e, m en [0.5, 1)
+    int b = (e - 1) * HIST_SUB + (int)((m - 0.5) * 2 * HIST_SUB);
+    return b < HIST_BUCKETS ? b : HIST_BUCKETS - 1;
+}
+
+static inline void stageEnd(int stage) {
+    StageStats* st = &stageStats[stage];
+    double us = (double)(SDL_GetPerformanceCounter() - st->start) * 1e6 / SDL_GetPerformanceFrequency();
+    st->count++;
+    st->totalMs += us / 1000.0;
+    if (us / 1000.0 > st->maxMs) st->maxMs = us / 1000.0;
+    st->hist[histBucket(us)]++;
+}
+
+// Percentil p (0..1) en ms: centro de la cubeta donde se alcanza p*count muestras
+double stagePercentile(const StageStats* st, double p) {
+    if (st->count == 0) return 0.0;
+    Uint64 target = (Uint64)ceil(p * st->count);
+    if (target < 1) target = 1;
+    Uint64 acc = 0;
+    for (int b = 0; b < HIST_BUCKETS; b++) {
+        acc += st->hist[b];
+        if (acc >= target) {
+            double ms = ldexp(1.0 + (b % HIST_SUB + 0.5) / HIST_SUB, b / HIST_SUB) / 1000.0;
+            return ms < st->maxMs ? ms : st->maxMs;
+        }
+    }
+    return st->maxMs;
+}
+
+// Tabla en consola y archivos <prefijo>.csv / <prefijo>.json
+void dumpStageStats(const char* prefix, int frames) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s.csv", prefix);
+    FILE* csv = fopen(path, "w");
+    snprintf(path, sizeof(path), "%s.json", prefix);
+    FILE* json = fopen(path, "w");
+
+    if (csv) fprintf(csv, "etapa,muestras,media_ms,p50_ms,p95_ms,p99_ms,max_ms\n");
+    if (json) fprintf(json, "{\n  \"frames\": %d,\n  \"etapas\": [\n", frames);
+    printf("%-15s %9s %9s %9s %9s %9s %9s\n", "etapa", "muestras", "media", "p50", "p95", "p99", "max");
+
+    for (int s = 0; s < NUM_STAGES; s++) {
+        const StageStats* st = &stageStats[s];
+        unsigned long long n = (unsigned long long)st->count;
+        double mean = st->count ? st->totalMs / st->count : 0.0;
+        double p50 = stagePercentile(st, 0.50);
+        double p95 = stagePercentile(st, 0.95);
+        double p99 = stagePercentile(st, 0.99);
+
+        printf("%-15s %9llu %9.3f %9.3f %9.3f %9.3f %9.3f\n",
+               stageNames[s], n, mean, p50, p95, p99, st->maxMs);
+        if (csv) fprintf(csv, "%s,%llu,%.4f,%.4f,%.4f,%.4f,%.4f\n",
+                         stageNames[s], n, mean, p50, p95, p99, st->maxMs);
+        if (json) fprintf(json, "    {\"etapa\": \"%s\", \"muestras\": %llu, \"media_ms\": %.4f, "
+                          "\"p50_ms\": %.4f, \"p95_ms\": %.4f, \"p99_ms\": %.4f, \"max_ms\": %.4f}%s\n",
+                          stageNames[s], n, mean, p50, p95, p99, st->maxMs, s + 1 < NUM_STAGES ? "," : "");
+    }
+
+    if (json) fprintf(json, "  ]\n}\n");
+    if (csv) fclose(csv);
+    if (json) fclose(json);
+}
+
 
 // Función para calcular la altura de la ola
 float waveHeight(float x, float z, float t) {
@@ -43,40 +165,311 @@ float waveHeight(float x, float z, float t) {
     );
 }
 
+// Estado del terreno que se conserva entre frames; se reserva solo si cambia gridSize.
+// Un solo buffer de alturas: sin hilo de fisica no hay nada que arme el siguiente frame
+// mientras se dibuja el actual
+typedef struct {
+    int size;               // vertices por lado
+    float* heights;         // altura de cada vertice
+    float* normals;         // normal de cada cuadro (3 floats), (size-1)^2 cuadros
+    Uint32* quadColors;     // color de cada cuadro
+} Terrain;
+
+Terrain terrain = {0};
+
+// Libera los buffers del terreno
+void freeTerrain(Terrain* tr) {
+    free(tr->heights);
+    free(tr->normals);
+    free(tr->quadColors);
+    *tr = (Terrain){0};
+}
+
+// Reserva los buffers si cambio el tamaño de la malla
+void ensureTerrain(Terrain* tr, int size) {
+    if (tr->size == size) return;
+    freeTerrain(tr);
+    int quads = (size - 1) * (size - 1);
+    tr->size = size;
+    tr->heights = malloc(size * size * sizeof(float));
+    tr->normals = malloc(3 * quads * sizeof(float));
+    tr->quadColors = malloc(quads * sizeof(Uint32));
+}
+
+static inline const float* terrainHeights(const Terrain* tr) {
+    return tr->heights;
+}
+
+// Precalculo de alturas del frame
+void buildTerrainHeights(Terrain* tr, float t) {
+    float* heights = tr->heights;
+    for (int i = 0; i < tr->size; i++) {
+        for (int j = 0; j < tr->size; j++) {
+            float x = i * SCALE;
+            float z = j * SCALE;
+            heights[i * tr->size + j] = waveHeight(x, z, t);
+        }
+    }
+}
+
+// Normales y color de cada cuadro a partir de las alturas
+void shadeTerrain(Terrain* tr, float t, float lightX, float lightY, float lightZ) {
+    int size = tr->size;
+    const float* h = terrainHeights(tr);
+
+    for (int i = 0; i < size - 1; i++) {
+        for (int j = 0; j < size - 1; j++) {
+            int q = i * (size - 1) + j;
+            float y0 = h[i * size + j];
+            float y1 = h[(i + 1) * size + j];
+            float y2 = h[i * size + (j + 1)];
+            float y3 = h[(i + 1) * size + (j + 1)];
+
+            // Normales
+            float hL = (i > 0) ? h[(i - 1) * size + j] : y0;
+            float hR = (i < size - 2) ? h[(i + 2) * size + j] : y1;
+            float hD = (j > 0) ? h[i * size + (j - 1)] : y0;
+            float hU = (j < size - 2) ? h[i * size + (j + 2)] : y2;
+
+            float nx = hL - hR, ny = 2.0f, nz = hD - hU;
+            float len = sqrtf(nx * nx + ny * ny + nz * nz);
+            if (len > 0.0f) {
+                nx /= len; ny /= len; nz /= len;
+            }
+            tr->normals[3 * q] = nx;
+            tr->normals[3 * q + 1] = ny;
+            tr->normals[3 * q + 2] = nz;
+
+            // Vector de Luz desde el centro del cuadro
+            float centerX = (i + 0.5f) * SCALE;
+            float centerY = (y0 + y1 + y2 + y3) * 0.25f;
+            float centerZ = (j + 0.5f) * SCALE;
+            float lx = lightX - centerX, ly = lightY - centerY, lz = lightZ - centerZ;
+            float llen = sqrtf(lx * lx + ly * ly + lz * lz);
+            lx /= llen; ly /= llen; lz /= llen;
+
+            // Difuso, si no choca con el vector de luz
+            float diff = fmaxf(0.0f, nx * lx + ny * ly + nz * lz);
+            float wave = 0.5f + 0.5f * sinf(t * 0.3f + (i + j) * 0.05f);
+
+            // Colores
+            Uint8 r = 10;
+            Uint8 g = (Uint8)((50 + 150 * diff) * wave);
+            Uint8 b = (Uint8)((100 + 100 * diff) * (1 - 0.3f * wave));
+            tr->quadColors[q] = (r << 16) | (g << 8) | b;
+        }
+    }
+}
+
+// Camara del frame: base de vista y matriz vista-proyeccion 4x4 (fila mayor).
+// clip = viewProj * (x,y,z,1); pantalla = (clip.x/clip.w, clip.y/clip.w), profundidad = clip.w
+#define CAMERA_FOCAL 500.0f   // distancia focal en pixeles
+#define CAMERA_NEAR 0.1f
+
+// Bits de recorte de un punto contra el volumen de vista (pantalla completa, w >= CAMERA_NEAR).
+// Cada bit es un semiespacio del mundo, así que si todos los vertices de una primitiva
+// comparten un bit, la primitiva completa queda fuera de la vista.
+#define CLIP_NEAR   1
+#define CLIP_LEFT   2
+#define CLIP_RIGHT  4
+#define CLIP_TOP    8
+#define CLIP_BOTTOM 16
+
+typedef struct {
+    float x, y, z;              // posicion
+    float lookX, lookY, lookZ;  // direccion de la vista (sin normalizar)
+    float right[3], up[3], forward[3];
+    float viewProj[16];
+} Camera;
+
+Camera camera;
+
+// Base de la camara (con inclinacion) y matriz vista-proyeccion
+void setCameraLookAt(Camera* cam, float camX, float camY, float camZ,
+                     float lookX, float lookY, float lookZ) {
+    cam->x = camX; cam->y = camY; cam->z = camZ;
+    cam->lookX = lookX; cam->lookY = lookY; cam->lookZ = lookZ;
+
+    float flen = sqrtf(lookX * lookX + lookY * lookY + lookZ * lookZ);
+    float f[3] = { lookX / flen, lookY / flen, lookZ / flen };
+
+    // Derecha horizontal; si se mira en vertical se usa el eje x
+    float hlen = sqrtf(lookX * lookX + lookZ * lookZ);
+    float r[3] = { 1.0f, 0.0f, 0.0f };
+    if (hlen > 1e-6f) { r[0] = lookZ / hlen; r[2] = -lookX / hlen; }
+
+    // Arriba = adelante x derecha
+    float u[3] = { f[1] * r[2] - f[2] * r[1], f[2] * r[0] - f[0] * r[2], f[0] * r[1] - f[1] * r[0] };
+
+    for (int k = 0; k < 3; k++) { cam->right[k] = r[k]; cam->up[k] = u[k]; cam->forward[k] = f[k]; }
+
+    float cx = (float)(windowWidth / 2), cy = (float)(windowHeight / 2);
+    float tr = -(r[0] * camX + r[1] * camY + r[2] * camZ);
+    float tu = -(u[0] * camX + u[1] * camY + u[2] * camZ);
+    float tf = -(f[0] * camX + f[1] * camY + f[2] * camZ);
+    float* m = cam->viewProj;
+    for (int k = 0; k < 3; k++) {
+        m[k]      = CAMERA_FOCAL * r[k] + cx * f[k];
+        m[4 + k]  = -CAMERA_FOCAL * u[k] + cy * f[k];
+        m[8 + k]  = f[k];
+        m[12 + k] = f[k];
+    }
+    m[3]  = CAMERA_FOCAL * tr + cx * tf;
+    m[7]  = -CAMERA_FOCAL * tu + cy * tf;
+    m[11] = tf;
+    m[15] = tf;
+}
+
 // Proyectar algo en 3D en 2D
-void project3D(float camX, float camY, float camZ, float lookX, float lookY, float lookZ,
-               float x, float y, float z, float *sx, float *sy, float *depth) {
-    // Mover para que camara este en (0,0,0)
-    float rx = x - camX;
-    float ry = y - camY;
-    float rz = z - camZ;
-    
-    // Vectores de direccion
-    float lx = lookX - camX;
-    float lz = lookZ - camZ;
-    
-    // Calculo de angulo de referencia
-    float angle = atan2f(lx, lz);
-    float ca = cosf(angle);
-    float sa = sinf(angle);
-
-    //Rotacion
-    float tx = ca * rx - sa * rz;
-    float tz = sa * rx + ca * rz;
-    float ty = ry;
-    
-    //Proyeccion en 2D
-    float fov = 500.0f;
-    if (tz <= 0.1f) tz = 0.1f;
-    *sx = windowWidth / 2 + tx * fov / tz;
-    *sy = windowHeight / 2 - ty * fov / tz;
-    *depth = tz;
+static inline void projectPoint(const Camera* cam, float x, float y, float z,
+                                float* sx, float* sy, float* depth, Uint8* outcode) {
+    const float* m = cam->viewProj;
+    float cx = m[0] * x + m[1] * y + m[2] * z + m[3];
+    float cy = m[4] * x + m[5] * y + m[6] * z + m[7];
+    float w = m[12] * x + m[13] * y + m[14] * z + m[15];
+
+    *outcode = (Uint8)((w < CAMERA_NEAR ? CLIP_NEAR : 0) |
+                       (cx < 0.0f ? CLIP_LEFT : 0) | (cx > windowWidth * w ? CLIP_RIGHT : 0) |
+                       (cy < 0.0f ? CLIP_TOP : 0) | (cy > windowHeight * w ? CLIP_BOTTOM : 0));
+
+    // Lo que queda detras del plano cercano se pega a el (esas primitivas se recortan aparte)
+    float wc = fmaxf(w, CAMERA_NEAR);
+    cx += (float)(windowWidth / 2) * (wc - w);
+    cy += (float)(windowHeight / 2) * (wc - w);
+    *sx = cx / wc;
+    *sy = cy / wc;
+    *depth = wc;
+}
+
+// Proyectar n puntos en lote
+void projectPoints(const Camera* cam, const float* x, const float* y, const float* z, int n,
+                   float* sx, float* sy, float* depth, Uint8* outcode) {
+    for (int k = 0; k < n; k++) {
+        projectPoint(cam, x[k], y[k], z[k], &sx[k], &sy[k], &depth[k], &outcode[k]);
+    }
+}
+
+// Coordenadas de recorte (cx, cy, w) de un punto, sin dividir
+static inline void clipPoint(const Camera* cam, float x, float y, float z, float out[3]) {
+    const float* m = cam->viewProj;
+    out[0] = m[0] * x + m[1] * y + m[2] * z + m[3];
+    out[1] = m[4] * x + m[5] * y + m[6] * z + m[7];
+    out[2] = m[12] * x + m[13] * y + m[14] * z + m[15];
+}
+
+// Recorta un triangulo en coordenadas de recorte contra el plano w = CAMERA_NEAR
+// (Sutherland-Hodgman). Deja el poligono resultante (0, 3 o 4 vertices) ya proyectado
+// y devuelve cuantos vertices tiene; se dibuja como abanico desde el vertice 0.
+int clipTriangleNear(const float in[3][3], float* sx, float* sy, float* depth) {
+    int n = 0;
+    for (int a = 0; a < 3; a++) {
+        const float* p = in[a];
+        const float* q = in[(a + 1) % 3];
+        int pIn = p[2] >= CAMERA_NEAR, qIn = q[2] >= CAMERA_NEAR;
+        if (pIn) {
+            sx[n] = p[0] / p[2]; sy[n] = p[1] / p[2]; depth[n] = p[2];
+            n++;
+        }
+        if (pIn != qIn) {
+            // Punto de la arista sobre el plano cercano
+            float s = (CAMERA_NEAR - p[2]) / (q[2] - p[2]);
+            sx[n] = (p[0] + s * (q[0] - p[0])) / CAMERA_NEAR;
+            sy[n] = (p[1] + s * (q[1] - p[1])) / CAMERA_NEAR;
+            depth[n] = CAMERA_NEAR;
+            n++;
+        }
+    }
+    return n;
+}
+
+// Vertices del terreno y centros de esferas proyectados una vez por frame
+typedef struct {
+    int terrainCapacity, sphereCapacity;
+    float *terrainX, *terrainY, *terrainDepth;
+    float *sphereX, *sphereY, *sphereDepth;
+    float *sphereWX, *sphereWY, *sphereWZ;  // Posicion interpolada entre pasos de fisica
+    Uint8 *terrainOut, *sphereOut;      // Bits de recorte (CLIP_*)
+} ProjectedScene;
+
+float renderAlpha = 1.0f;   // Fraccion del paso de fisica transcurrida, para interpolar
+
+ProjectedScene projected = {0};
+
+// Libera los buffers de proyeccion
+void freeProjectedScene(ProjectedScene* ps) {
+    free(ps->terrainX); free(ps->terrainY); free(ps->terrainDepth);
+    free(ps->sphereX); free(ps->sphereY); free(ps->sphereDepth);
+    free(ps->sphereWX); free(ps->sphereWY); free(ps->sphereWZ);
+    free(ps->terrainOut); free(ps->sphereOut);
+    *ps = (ProjectedScene){0};
+}
+
+// Proyecta la malla del terreno y las esferas con la camara del frame
+void projectScene(ProjectedScene* ps, const Camera* cam, const Terrain* tr) {
+    int nv = tr->size * tr->size;
+    if (nv > ps->terrainCapacity) {
+        free(ps->terrainX); free(ps->terrainY); free(ps->terrainDepth); free(ps->terrainOut);
+        ps->terrainX = malloc(nv * sizeof(float));
+        ps->terrainY = malloc(nv * sizeof(float));
+        ps->terrainDepth = malloc(nv * sizeof(float));
+        ps->terrainOut = malloc(nv * sizeof(Uint8));
+        ps->terrainCapacity = nv;
+    }
+    if (numSpheres > ps->sphereCapacity) {
+        free(ps->sphereX); free(ps->sphereY); free(ps->sphereDepth); free(ps->sphereOut);
+        free(ps->sphereWX); free(ps->sphereWY); free(ps->sphereWZ);
+        ps->sphereWX = malloc(numSpheres * sizeof(float));
+        ps->sphereWY = malloc(numSpheres * sizeof(float));
+        ps->sphereWZ = malloc(numSpheres * sizeof(float));
+        ps->sphereX = malloc(numSpheres * sizeof(float));
+        ps->sphereY = malloc(numSpheres * sizeof(float));
+        ps->sphereDepth = malloc(numSpheres * sizeof(float));
+        ps->sphereOut = malloc(numSpheres * sizeof(Uint8));
+        ps->sphereCapacity = numSpheres;
+    }
+
+    // Terreno por filas: x constante, z = j*SCALE
+    const float* heights = terrainHeights(tr);
+    int size = tr->size;
+    for (int i = 0; i < size; i++) {
+        // Coordenadas de la fila en tandas de PROJECT_BLOCK puntos, en la pila
+        float xs[PROJECT_BLOCK], zs[PROJECT_BLOCK];
+        for (int j0 = 0; j0 < size; j0 += PROJECT_BLOCK) {
+            int n = size - j0 < PROJECT_BLOCK ? size - j0 : PROJECT_BLOCK;
+            for (int k = 0; k < n; k++) {
+                xs[k] = i * SCALE;
+                zs[k] = (j0 + k) * SCALE;
+            }
+            int v = i * size + j0;
+            projectPoints(cam, xs, &heights[v], zs, n,
+                          &ps->terrainX[v], &ps->terrainY[v], &ps->terrainDepth[v],
+                          &ps->terrainOut[v]);
+        }
+    }
+
+    // Esferas entre el paso anterior y el actual
+    float a = renderAlpha;
+    for (int i = 0; i < activeCount; i++) {
+        ps->sphereWX[i] = spheres[i].px + a * (spheres[i].x - spheres[i].px);
+        ps->sphereWY[i] = spheres[i].py + a * (spheres[i].y - spheres[i].py);
+        ps->sphereWZ[i] = spheres[i].pz + a * (spheres[i].z - spheres[i].pz);
+        projectPoint(cam, ps->sphereWX[i], ps->sphereWY[i], ps->sphereWZ[i],
+                     &ps->sphereX[i], &ps->sphereY[i], &ps->sphereDepth[i],
+                     &ps->sphereOut[i]);
+    }
+}
+
+// Buffers alineados a 64 bytes: framebuffer y z-buffer quedan con el mismo desfase
+// en cada pixel, asi la limpieza vectorial avanza los dos a la vez
+static void* renderArray(size_t bytes) {
+    bytes = (bytes + RENDER_ALIGN - 1) / RENDER_ALIGN * RENDER_ALIGN;
+    return aligned_alloc(RENDER_ALIGN, bytes);
 }
 
 // Inicializar el buffer y zbuffer
 void initRenderBuffers() {
-    frameBuffer = malloc(windowWidth * windowHeight * sizeof(Uint32));
-    zbuffer = malloc(windowWidth * windowHeight * sizeof(float));
+    frameBuffer = renderArray((size_t)windowWidth * windowHeight * sizeof(Uint32));
+    zbuffer = renderArray((size_t)windowWidth * windowHeight * sizeof(float));
 }
 
 // Libera las memorias de los buffers
@@ -102,8 +495,8 @@ void resizeRenderBuffers(SDL_Renderer* renderer) {
 
 
 // Se inicializan las esferas
-void initSpheres(int n) {
-    srand((unsigned int)time(NULL));
+void initSpheres(int n, unsigned int seed) {
+    srand(seed);  // misma semilla -> misma escena
     if (n > DEF_SPHERES) n = DEF_SPHERES;
     numSpheres = n;
 
@@ -118,29 +511,73 @@ void initSpheres(int n) {
         spheres[i].r = 0.3f + ((rand() % 100) / 100.0f) * 0.7f;
         spheres[i].g = 0.3f + ((rand() % 100) / 100.0f) * 0.7f;
         spheres[i].b = 0.3f + ((rand() % 100) / 100.0f) * 0.7f;
-        spheres[i].active = 1;
+        sphereSlot[i] = i;
+        sphereId[i] = i;
     }
+    activeCount = 0;  // Todas empiezan inactivas, el spawner las activa
 }
 
-//Fisica de esferas
-void updatePhysics(float t) {
+// Intercambiar dos posiciones manteniendo los mapas id <-> posicion
+void swapSphereSlots(int a, int b) {
+    if (a == b) return;
+    Sphere tmp = spheres[a];
+    spheres[a] = spheres[b];
+    spheres[b] = tmp;
+
+    int ida = sphereId[a], idb = sphereId[b];
+    sphereId[a] = idb; sphereSlot[idb] = a;
+    sphereId[b] = ida; sphereSlot[ida] = b;
+}
+
+// Activar por id: pasa al final del bloque activo, O(1)
+void activateSphere(int id) {
+    int slot = sphereSlot[id];
+    if (slot < activeCount) return;
+    swapSphereSlots(slot, activeCount);
+    // Sin paso anterior: se dibuja donde esta
+    spheres[activeCount].px = spheres[activeCount].x;
+    spheres[activeCount].py = spheres[activeCount].y;
+    spheres[activeCount].pz = spheres[activeCount].z;
+    activeCount++;
+}
+
+// Desactivar por id: la ultima activa ocupa su lugar, O(1)
+void deactivateSphere(int id) {
+    int slot = sphereSlot[id];
+    if (slot >= activeCount) return;
+    activeCount--;
+    swapSphereSlots(slot, activeCount);
+}
+
+//Fisica de esferas: un paso de h pasos base, con la ola en el tiempo t
+void updatePhysics(float t, float h) {
     // Movimiento y Rebote
-    for (int i = 0; i < numSpheres; i++) {
-        if (!spheres[i].active) continue;
-        
+    stageBegin(STAGE_INTEGRATE);
+    for (int i = 0; i < activeCount; i++) {
+        // Posicion al inicio del paso, para interpolar el dibujo
+        spheres[i].px = spheres[i].x;
+        spheres[i].py = spheres[i].y;
+        spheres[i].pz = spheres[i].z;
+
         // Valores inciales
-        spheres[i].x += spheres[i].vx;
-        spheres[i].z += spheres[i].vz;
-        spheres[i].vy += GRAVITY;
-        spheres[i].y += spheres[i].vy;
+        spheres[i].x += spheres[i].vx * h;
+        spheres[i].z += spheres[i].vz * h;
+        spheres[i].vy += GRAVITY * h;
+        spheres[i].y += spheres[i].vy * h;
 
         //Altura del piso
         float floorY = waveHeight(spheres[i].x, spheres[i].z, t) + spheres[i].radius;
+        float floorV = (floorY - spheres[i].floorY) / h;
+        spheres[i].floorY = floorY;
         
-        // Rebote con el piso
+        // Rebote con el piso, relativo a la velocidad de la ola; si el choque es
+        // lento la esfera acompana al piso y el roce frena la velocidad horizontal
         if (spheres[i].y < floorY) {
             spheres[i].y = floorY;
-            spheres[i].vy *= -BOUNCE;
+            float rel = spheres[i].vy - floorV;
+            spheres[i].vy = fabsf(rel) < GROUND_STICK ? floorV : floorV - BOUNCE * rel;
+            spheres[i].vx *= GROUND_FRICTION;
+            spheres[i].vz *= GROUND_FRICTION;
         }
         
         // Rebote con la pared
@@ -149,13 +586,12 @@ void updatePhysics(float t) {
         if (spheres[i].z < 0 || spheres[i].z > gridSize * SCALE) 
             spheres[i].vz *= -1;
     }
+    stageEnd(STAGE_INTEGRATE);
 
     // Colisiones entre esferas
-    for (int i = 0; i < numSpheres; i++) {
-        if (!spheres[i].active) continue;
-        
-        for (int j = i + 1; j < numSpheres; j++) {
-            if (!spheres[j].active) continue;
+    stageBegin(STAGE_COLLIDE);
+    for (int i = 0; i < activeCount; i++) {
+        for (int j = i + 1; j < activeCount; j++) {
 
             // Distancias entre 2 esferas
             float dx = spheres[j].x - spheres[i].x;
@@ -198,143 +634,198 @@ void updatePhysics(float t) {
             }
         }
     }
+    stageEnd(STAGE_COLLIDE);
 }
 
-// Reset Z-buffer
-void resetZBuffer() {
-    for (int i = 0; i < windowWidth * windowHeight; i++) {
-        zbuffer[i] = 1e30f;
+// Limpieza del frame con stores no temporales: el frame completo no cabe en caché,
+// así que escribirlo sin leerlo ni traerlo a la caché ahorra una pasada de memoria
+void clearRenderBuffers() {
+    int n = windowWidth * windowHeight;
+    int i = 0;
+#if defined(__SSE2__)
+    for (; i < n && ((uintptr_t)(frameBuffer + i) & 15); i++) {
         frameBuffer[i] = 0;
+        zbuffer[i] = DEPTH_CLEAR;
+    }
+    __m128i zero = _mm_setzero_si128();
+    __m128 far = _mm_set1_ps(DEPTH_CLEAR);
+    for (; i + 4 <= n; i += 4) {
+        _mm_stream_si128((__m128i*)(frameBuffer + i), zero);
+        _mm_stream_ps(zbuffer + i, far);
+    }
+    _mm_sfence();
+#endif
+    for (; i < n; i++) {
+        frameBuffer[i] = 0;
+        zbuffer[i] = DEPTH_CLEAR;
     }
 }
 
 
-// Versión de drawTriangle que recorta a un cuadrante
+// Version de drawTriangle que recorta a un cuadrante
+// Usa funciones de arista enteras que avanzan fila por fila: en cada fila se calcula
+// el tramo [xl, xr] donde las tres aristas son >= 0 (las filas vacias no tocan pixeles)
+// y la profundidad avanza con un incremento constante por pixel
 void drawTriangleClipped(int x1, int y1, float z1,
                          int x2, int y2, float z2,
                          int x3, int y3, float z3,
                          Uint32 color,
                          int minX, int maxX, int minY, int maxY) {
-    // Calcular el cuadrado mas pequeño en la pantalla que incluye al triangulo
-    int minTx = fmax(minX, fmin(x1, fmin(x2, x3)));
-    int maxTx = fmin(maxX - 1, fmax(x1, fmax(x2, x3)));
-    int minTy = fmax(minY, fmin(y1, fmin(y2, y3)));
-    int maxTy = fmin(maxY - 1, fmax(y1, fmax(y2, y3)));
-    
+    // Doble del area con signo, se ordenan los vertices para que sea positiva
+    long long area = (long long)(x2 - x1)*(y3 - y1) - (long long)(x3 - x1)*(y2 - y1);
+    if (area == 0) return;
+    if (area < 0) {
+        int tx = x2; x2 = x3; x3 = tx;
+        int ty = y2; y2 = y3; y3 = ty;
+        float tz = z2; z2 = z3; z3 = tz;
+        area = -area;
+    }
+
+    // Calcular el cuadrado mas pequeño que incluye al triangulo
+    int minTx = x1 < x2 ? (x1 < x3 ? x1 : x3) : (x2 < x3 ? x2 : x3);
+    int maxTx = x1 > x2 ? (x1 > x3 ? x1 : x3) : (x2 > x3 ? x2 : x3);
+    int minTy = y1 < y2 ? (y1 < y3 ? y1 : y3) : (y2 < y3 ? y2 : y3);
+    int maxTy = y1 > y2 ? (y1 > y3 ? y1 : y3) : (y2 > y3 ? y2 : y3);
+    if (minTx < minX) minTx = minX;
+    if (maxTx > maxX-1) maxTx = maxX-1;
+    if (minTy < minY) minTy = minY;
+    if (maxTy > maxY-1) maxTy = maxY-1;
+    if (minTx > maxTx || minTy > maxTy) return;
+
+    // Aristas 2->3, 3->1 y 1->2: E(x,y) = A*x + B*y + C, positivas dentro del triangulo
+    long long A[3] = { y2 - y3, y3 - y1, y1 - y2 };
+    long long B[3] = { x3 - x2, x1 - x3, x2 - x1 };
+    long long row[3] = {
+        A[0]*(minTx - x2) + B[0]*(minTy - y2),
+        A[1]*(minTx - x3) + B[1]*(minTy - y3),
+        A[2]*(minTx - x1) + B[2]*(minTy - y1)
+    };
+
+    // Profundidad = (E0*z1 + E1*z2 + E2*z3) / area, lineal en x e y
+    float invArea = 1.0f / (float)area;
+    float dzdx = (A[0]*z1 + A[1]*z2 + A[2]*z3) * invArea;
+    float dzdy = (B[0]*z1 + B[1]*z2 + B[2]*z3) * invArea;
+    float zRow = (row[0]*z1 + row[1]*z2 + row[2]*z3) * invArea;
 
-    float denom = (float)((y2 - y3) * (x1 - x3) + (x3 - x2) * (y1 - y3));
-    
-    // Pesos baricéntricos
     for (int y = minTy; y <= maxTy; y++) {
-        for (int x = minTx; x <= maxTx; x++) {
-            float w1 = ((y2 - y3) * (x - x3) + (x3 - x2) * (y - y3)) / denom;
-            float w2 = ((y3 - y1) * (x - x3) + (x1 - x3) * (y - y3)) / denom;
-            float w3 = 1.0f - w1 - w2;
-
-            // Si los pesos son mayores a 1, adentro del triangulo
-            if (w1 >= 0 && w2 >= 0 && w3 >= 0) {
-                float depth = w1 * z1 + w2 * z2 + w3 * z3;
-                int idx = y * windowWidth + x;
+        // Tramo de la fila donde las tres aristas son >= 0
+        int xl = minTx, xr = maxTx;
+        for (int e = 0; e < 3 && xl <= xr; e++) {
+            if (A[e] > 0) {
+                if (row[e] < 0) {
+                    long long step = (-row[e] + A[e] - 1) / A[e];
+                    if (minTx + step > xl) xl = (int)(minTx + step > maxTx + 1 ? maxTx + 1 : minTx + step);
+                }
+            } else if (A[e] < 0) {
+                if (row[e] < 0) { xr = xl - 1; break; }
+                long long step = row[e] / -A[e];
+                if (minTx + step < xr) xr = (int)(minTx + step);
+            } else if (row[e] < 0) {
+                xr = xl - 1;
+            }
+        }
+
+        if (xl <= xr) {
+            float depth = zRow + dzdx*(xl - minTx);
+            int idx = y*windowWidth + xl;
+            for (int x = xl; x <= xr; x++, idx++) {
                 if (depth < zbuffer[idx]) {
                     zbuffer[idx] = depth;
                     frameBuffer[idx] = color;
                 }
+                depth += dzdx;
             }
         }
+
+        row[0] += B[0]; row[1] += B[1]; row[2] += B[2];
+        zRow += dzdy;
     }
 }
 
 // Render Cuadrante
-void renderSceneQuadrant(int minX, int maxX, int minY, int maxY,
-                         SDL_Renderer* renderer, float t,
-                         float lightX, float lightY, float lightZ,
-                         float camX, float camY, float camZ,
-                         float lookX, float lookY, float lookZ,
-                         float* precomputedHeights) {
-    
+// Dibuja el triangulo de vertices a, b, c del terreno. Si cruza el plano cercano se
+// recorta en coordenadas de recorte y se dibuja como abanico de 1 o 2 triangulos.
+void drawTerrainTriangle(int a, int b, int c, Uint32 color,
+                         const Camera* cam, const float* heights, const ProjectedScene* ps,
+                         int minX, int maxX, int minY, int maxY) {
+    if (ps->terrainOut[a] & ps->terrainOut[b] & ps->terrainOut[c]) return;
+
+    if (!((ps->terrainOut[a] | ps->terrainOut[b] | ps->terrainOut[c]) & CLIP_NEAR)) {
+        drawTriangleClipped(ps->terrainX[a], ps->terrainY[a], ps->terrainDepth[a],
+                            ps->terrainX[b], ps->terrainY[b], ps->terrainDepth[b],
+                            ps->terrainX[c], ps->terrainY[c], ps->terrainDepth[c],
+                            color, minX, maxX, minY, maxY);
+        return;
+    }
+
+    int v[3] = { a, b, c };
+    float clip[3][3], px[4], py[4], pz[4];
+    for (int k = 0; k < 3; k++)
+        clipPoint(cam, (v[k] / gridSize) * SCALE, heights[v[k]], (v[k] % gridSize) * SCALE, clip[k]);
+    int n = clipTriangleNear(clip, px, py, pz);
+    for (int f = 0; f + 2 < n; f++) {
+        drawTriangleClipped(px[0], py[0], pz[0],
+                            px[f + 1], py[f + 1], pz[f + 1],
+                            px[f + 2], py[f + 2], pz[f + 2],
+                            color, minX, maxX, minY, maxY);
+    }
+}
+
+void renderTerrainQuadrant(int minX, int maxX, int minY, int maxY,
+                           const Camera* cam,
+                           const Terrain* tr,
+                           const ProjectedScene* ps) {
+    const float* heights = terrainHeights(tr);
+
     // Render Terreno
     for (int i = 0; i < gridSize - 1; i++) {
         for (int j = 0; j < gridSize - 1; j++) {
-            // Esquinas
-            float x0 = i * SCALE, z0 = j * SCALE;
-            float x1 = (i + 1) * SCALE, z1 = j * SCALE;
-            float x2 = i * SCALE, z2 = (j + 1) * SCALE;
-            float x3 = (i + 1) * SCALE, z3 = (j + 1) * SCALE;
-            
-            // Altura de Esquinas
-            float y0 = precomputedHeights[i * gridSize + j];
-            float y1 = precomputedHeights[(i + 1) * gridSize + j];
-            float y2 = precomputedHeights[i * gridSize + (j + 1)];
-            float y3 = precomputedHeights[(i + 1) * gridSize + (j + 1)];
+            // Indices de las esquinas
+            int v0 = i * gridSize + j;
+            int v1 = (i + 1) * gridSize + j;
+            int v2 = v0 + 1;
+            int v3 = v1 + 1;
 
             // Centro del Grid
-            float centerX = (x0 + x1 + x2 + x3) * 0.25f;
-            float centerY = (y0 + y1 + y2 + y3) * 0.25f;
-            float centerZ = (z0 + z1 + z2 + z3) * 0.25f;
+            float centerX = (i + 0.5f) * SCALE;
+            float centerY = (heights[v0] + heights[v1] + heights[v2] + heights[v3]) * 0.25f;
+            float centerZ = (j + 0.5f) * SCALE;
             
             // Vectores de direccion de la camara al centro
-            float dx = centerX - camX;
-            float dy = centerY - camY;
-            float dz = centerZ - camZ;
+            float dx = centerX - cam->x;
+            float dy = centerY - cam->y;
+            float dz = centerZ - cam->z;
             float dist2 = dx * dx + dy * dy + dz * dz;
             if (dist2 < 1.0f) continue;
 
-            // Proyeccion en 2D
-            float sx0, sy0, sz0, sx1, sy1, sz1, sx2, sy2, sz2, sx3, sy3, sz3;
-            project3D(camX, camY, camZ, camX + lookX, camY + lookY, camZ + lookZ,
-                     x0, y0, z0, &sx0, &sy0, &sz0);
-            project3D(camX, camY, camZ, camX + lookX, camY + lookY, camZ + lookZ,
-                     x1, y1, z1, &sx1, &sy1, &sz1);
-            project3D(camX, camY, camZ, camX + lookX, camY + lookY, camZ + lookZ,
-                     x2, y2, z2, &sx2, &sy2, &sz2);
-            project3D(camX, camY, camZ, camX + lookX, camY + lookY, camZ + lookZ,
-                     x3, y3, z3, &sx3, &sy3, &sz3);
-            
+            // Color del cuadro, calculado una vez por frame en shadeTerrain
+            Uint32 color = tr->quadColors[i * (gridSize - 1) + j];
 
-            // Normales
-            float hL = (i > 0) ? precomputedHeights[(i - 1) * gridSize + j] : y0;
-            float hR = (i < gridSize - 2) ? precomputedHeights[(i + 2) * gridSize + j] : y1;
-            float hD = (j > 0) ? precomputedHeights[i * gridSize + (j - 1)] : y0;
-            float hU = (j < gridSize - 2) ? precomputedHeights[i * gridSize + (j + 2)] : y2;
-            
-            float nx = hL - hR, ny = 2.0f, nz = hD - hU;
-            float len = sqrtf(nx * nx + ny * ny + nz * nz);
-            if (len > 0.0f) {
-                nx /= len; ny /= len; nz /= len;
-            }
-            
-            // Vector de Luz
-            float lx = lightX - centerX, ly = lightY - centerY, lz = lightZ - centerZ;
-            float llen = sqrtf(lx * lx + ly * ly + lz * lz);
-            lx /= llen; ly /= llen; lz /= llen;
-
-            // Difuso, si no choca con el vector de luz
-            float diff = fmaxf(0.0f, nx * lx + ny * ly + nz * lz);
-            float wave = 0.5f + 0.5f * sinf(t * 0.3f + (i + j) * 0.05f);
-            
-            // Colores
-            Uint8 r = 10;
-            Uint8 g = (Uint8)((50 + 150 * diff) * wave);
-            Uint8 b = (Uint8)((100 + 100 * diff) * (1 - 0.3f * wave));
-            Uint32 color = (r << 16) | (g << 8) | b;
+            // Fuera del volumen de vista: las 4 esquinas del mismo lado de un plano
+            if (ps->terrainOut[v0] & ps->terrainOut[v1] & ps->terrainOut[v2] & ps->terrainOut[v3])
+                continue;
 
-            //Dibujar triangulos
-            drawTriangleClipped(sx0, sy0, sz0, sx1, sy1, sz1, sx2, sy2, sz2, 
-                              color, minX, maxX, minY, maxY);
-            drawTriangleClipped(sx1, sy1, sz1, sx3, sy3, sz3, sx2, sy2, sz2, 
-                              color, minX, maxX, minY, maxY);
+            //Dibujar triangulos con las esquinas ya proyectadas
+            drawTerrainTriangle(v0, v1, v2, color, cam, heights, ps, minX, maxX, minY, maxY);
+            drawTerrainTriangle(v1, v3, v2, color, cam, heights, ps, minX, maxX, minY, maxY);
         }
     }
+}
 
+void renderSpheresQuadrant(int minX, int maxX, int minY, int maxY,
+                           float lightX, float lightY, float lightZ,
+                           const ProjectedScene* ps) {
     // Render Esferas
-    for (int i = 0; i < numSpheres; i++) {
-        if (!spheres[i].active) continue;
-
-        float sx, sy, depth;
-        project3D(camX, camY, camZ, camX + lookX, camY + lookY, camZ + lookZ,
-                  spheres[i].x, spheres[i].y, spheres[i].z, &sx, &sy, &depth);
+    for (int i = 0; i < activeCount; i++) {
+        // El centro detras del plano cercano no tiene proyeccion valida
+        if (ps->sphereOut[i] & CLIP_NEAR) continue;
 
+        float sx = ps->sphereX[i], sy = ps->sphereY[i], depth = ps->sphereDepth[i];
         int radius = (int)(spheres[i].radius * windowWidth / (2 * depth + 1));
+
+        // Cuadrado de la esfera fuera del cuadrante: no hay pixeles que recorrer
+        if (sx + radius < minX - 1 || sx - radius >= maxX ||
+            sy + radius < minY - 1 || sy - radius >= maxY) continue;
         
         // Recorrer pixeles de esfera
         for (int dy = -radius; dy <= radius; dy++) {
@@ -353,9 +844,9 @@ void renderSceneQuadrant(int minX, int maxX, int minY, int maxY,
                         float ny = -dy / (float)radius;
                         float nz = sqrtf(fmaxf(0.0f, 1 - nx * nx - ny * ny));
                         // Posicion en 3D
-                        float px3D = spheres[i].x + nx * spheres[i].radius;
-                        float py3D = spheres[i].y + ny * spheres[i].radius;
-                        float pz3D = spheres[i].z + nz * spheres[i].radius;
+                        float px3D = ps->sphereWX[i] + nx * spheres[i].radius;
+                        float py3D = ps->sphereWY[i] + ny * spheres[i].radius;
+                        float pz3D = ps->sphereWZ[i] + nz * spheres[i].radius;
                         
                         // Luz
                         float lx = lightX - px3D, ly = lightY - py3D, lz = lightZ - pz3D;
@@ -377,97 +868,227 @@ void renderSceneQuadrant(int minX, int maxX, int minY, int maxY,
 }
 
 // Renderizar Escena
-void renderScene(SDL_Renderer* renderer, float t,
+void renderScene(SDL_Renderer* renderer,
                  float lightX, float lightY, float lightZ,
-                 float camX, float camY, float camZ,
-                 float lookX, float lookY, float lookZ,
-                 float* precomputedHeights) {
-    // Renderizar Cuadrante
-    renderSceneQuadrant(0, windowWidth, 0, windowHeight,
-                       renderer, t,
-                       lightX, lightY, lightZ,
-                       camX, camY, camZ,
-                       lookX, lookY, lookZ,
-                       precomputedHeights);
-}
-
-//Actualizar vistas de la camara
+                 const Camera* cam,
+                 const Terrain* tr) {
+    // Proyectar una sola vez
+    stageBegin(STAGE_RASTER_TERRAIN);
+    projectScene(&projected, cam, tr);
+
+    // Terreno completo primero y luego las esferas, cada uno medido por separado
+    renderTerrainQuadrant(0, windowWidth, 0, windowHeight,
+                          cam, tr, &projected);
+    stageEnd(STAGE_RASTER_TERRAIN);
+
+    stageBegin(STAGE_SPLAT_SPHERES);
+    renderSpheresQuadrant(0, windowWidth, 0, windowHeight,
+                          lightX, lightY, lightZ, &projected);
+    stageEnd(STAGE_SPLAT_SPHERES);
+}
+
+//Actualizar vistas de la camara y su matriz de vista
 void updateCameraView(int viewMode, float centerX, float centerZ, float radius, 
-                     float *camX, float *camY, float *camZ,
-                     float *lookX, float *lookY, float *lookZ, float *yaw) {
+                     float *yaw, Camera* cam) {
+    float camX, camY, camZ;
+    float lookX, lookY, lookZ;
     switch(viewMode) {
         case 1: // Rotando alrededor del centro
             *yaw += 0.01f;
-            *camX = centerX + radius * sinf(*yaw);
-            *camZ = centerZ + radius * cosf(*yaw);
-            *camY = 10.0f;
-            *lookX = centerX - *camX;
-            *lookY = -(*camY);
-            *lookZ = centerZ - *camZ;
+            camX = centerX + radius * sinf(*yaw);
+            camZ = centerZ + radius * cosf(*yaw);
+            camY = 10.0f;
+            lookX = centerX - camX;
+            lookY = -camY;
+            lookZ = centerZ - camZ;
             break;
             
         case 2: // Vista desde el cielo
-            *camX = centerX - 20.0f;
-            *camY = 35.0f;
-            *camZ = centerZ - 20.0f;
-            *lookX = centerX - *camX;
-            *lookY = 5.0f - *camY;
-            *lookZ = centerZ - *camZ;
+            camX = centerX - 20.0f;
+            camY = 35.0f;
+            camZ = centerZ - 20.0f;
+            lookX = centerX - camX;
+            lookY = 5.0f - camY;
+            lookZ = centerZ - camZ;
             break;
             
         case 3: // Vista lateral fija
-            *camX = -20.0f;
-            *camY = 10.0f;
-            *camZ = centerZ;
-            *lookX = centerX + 20.0f;
-            *lookY = -(*camY);
-            *lookZ = centerZ - *camZ;
+            camX = -20.0f;
+            camY = 10.0f;
+            camZ = centerZ;
+            lookX = centerX + 20.0f;
+            lookY = -camY;
+            lookZ = centerZ - camZ;
             break;
             
         default: // fallback
-            *camX = centerX + radius * sinf(*yaw);
-            *camZ = centerZ + radius * cosf(*yaw);
-            *camY = 15.0f;
-            *lookX = centerX - *camX;
-            *lookY = -(*camY);
-            *lookZ = centerZ - *camZ;
+            camX = centerX + radius * sinf(*yaw);
+            camZ = centerZ + radius * cosf(*yaw);
+            camY = 15.0f;
+            lookX = centerX - camX;
+            lookY = -camY;
+            lookZ = centerZ - camZ;
             break;
     }
+    setCameraLookAt(cam, camX, camY, camZ, lookX, lookY, lookZ);
+}
+
+// ===== Log de FPS asíncrono =====
+// El hilo del frame solo copia un registro a un buffer circular (un productor, un
+// consumidor); un hilo aparte lo vacía al archivo. Si el buffer se llena el registro
+// se descarta y se cuenta, nunca se bloquea el frame.
+#define METRICS_RING_SIZE 4096      // Potencia de 2
+#define METRICS_DRAIN_MS 10         // Espera del escritor cuando no hay registros
+
+typedef struct {
+    float fps;
+} MetricRecord;
+
+typedef struct {
+    MetricRecord records[METRICS_RING_SIZE];
+    SDL_atomic_t head;      // Próximo registro a escribir (solo el hilo del frame)
+    SDL_atomic_t tail;      // Próximo registro a leer (solo el hilo escritor)
+    SDL_atomic_t running;
+    SDL_atomic_t dropped;   // Registros descartados por buffer lleno
+    Uint64 written;         // Registros escritos al archivo
+    int maxPending;         // Máximo de registros en espera observado por el escritor
+    FILE* file;
+    SDL_Thread* thread;
+} MetricsLog;
+
+MetricsLog metricsLog;
+
+static int metricsWriter(void* data) {
+    MetricsLog* log = (MetricsLog*)data;
+    for (;;) {
+        int running = SDL_AtomicGet(&log->running);
+        unsigned int tail = (unsigned int)SDL_AtomicGet(&log->tail);
+        unsigned int head = (unsigned int)SDL_AtomicGet(&log->head);
+        SDL_MemoryBarrierAcquire();
+
+        int pending = (int)(head - tail);
+        if (pending > log->maxPending) log->maxPending = pending;
+        for (; tail != head; tail++)
+            fprintf(log->file, "%.2f\n", log->records[tail & (METRICS_RING_SIZE - 1)].fps);
+        log->written += pending;
+        SDL_AtomicSet(&log->tail, (int)tail);
+
+        if (pending > 0) fflush(log->file);
+        else if (!running) break;    // Ya se vació todo lo que dejó el frame
+        else SDL_Delay(METRICS_DRAIN_MS);
+    }
+    return 0;
+}
+
+int metricsLogOpen(MetricsLog* log, const char* path) {
+    memset(log, 0, sizeof(*log));
+    log->file = fopen(path, "w");
+    if (!log->file) return 0;
+    SDL_AtomicSet(&log->running, 1);
+    log->thread = SDL_CreateThread(metricsWriter, "metricsWriter", log);
+    if (!log->thread) {
+        fclose(log->file);
+        log->file = NULL;
+        return 0;
+    }
+    return 1;
+}
+
+// Llamado desde el hilo del frame: nunca espera
+static inline void metricsLogPush(MetricsLog* log, float fps) {
+    if (!log->thread) return;
+    unsigned int head = (unsigned int)SDL_AtomicGet(&log->head);
+    unsigned int tail = (unsigned int)SDL_AtomicGet(&log->tail);
+    if (head - tail >= METRICS_RING_SIZE) {
+        SDL_AtomicAdd(&log->dropped, 1);
+        return;
+    }
+    log->records[head & (METRICS_RING_SIZE - 1)].fps = fps;
+    SDL_MemoryBarrierRelease();
+    SDL_AtomicSet(&log->head, (int)(head + 1));
+}
+
+void metricsLogClose(MetricsLog* log) {
+    if (!log->thread) return;
+    SDL_AtomicSet(&log->running, 0);
+    SDL_WaitThread(log->thread, NULL);
+    log->thread = NULL;
+    fclose(log->file);
+    log->file = NULL;
+    printf("Log de FPS: %llu escritos, %d descartados, máximo en espera %d de %d\n",
+           (unsigned long long)log->written, SDL_AtomicGet(&log->dropped),
+           log->maxPending, METRICS_RING_SIZE);
+}
+
+// Hash FNV-1a del framebuffer: dos corridas con la misma semilla deben dar el mismo valor
+Uint32 frameHash(void) {
+    Uint32 h = 2166136261u;
+    const unsigned char* bytes = (const unsigned char*)frameBuffer;
+    size_t n = (size_t)windowWidth * windowHeight * sizeof(Uint32);
+    for (size_t i = 0; i < n; i++) {
+        h ^= bytes[i];
+        h *= 16777619u;
+    }
+    return h;
 }
 
 // Main 
 int main(int argc, char* argv[]) {
-    // Argumentos Iniciales
-    if (argc > 1) numSpheres = atoi(argv[1]);
+    // Argumentos Iniciales: [esferas] [grid] [--headless] [--frames N] [--seed S] [--physics-hz H]
+    int headless = 0;
+    int maxFrames = 0;  // 0 = sin límite
+    int physicsHz = PHYSICS_BASE_HZ;
+    unsigned int seed = (unsigned int)time(NULL);
+    int positional = 0;
+    for (int a = 1; a < argc; a++) {
+        if (strcmp(argv[a], "--headless") == 0) headless = 1;
+        else if (strcmp(argv[a], "--frames") == 0 && a + 1 < argc) maxFrames = atoi(argv[++a]);
+        else if (strcmp(argv[a], "--seed") == 0 && a + 1 < argc) seed = (unsigned int)strtoul(argv[++a], NULL, 10);
+        else if (strcmp(argv[a], "--physics-hz") == 0 && a + 1 < argc) physicsHz = atoi(argv[++a]);
+        else if (strncmp(argv[a], "--", 2) == 0) {
+            // Opcion desconocida o sin su valor: se avisa en vez de correr con los valores por defecto
+            printf("Opcion no reconocida: %s\n", argv[a]);
+            printf("Uso: %s [esferas] [grid] [--headless] [--frames N] [--seed S] [--physics-hz H]\n", argv[0]);
+            return 1;
+        }
+        else if (positional == 0) { numSpheres = atoi(argv[a]); positional++; }
+        else if (positional == 1) { gridSize = atof(argv[a]); positional++; }
+    }
     if (numSpheres <= 0) numSpheres = DEF_SPHERES;
-
-    if (argc > 2) gridSize = atof(argv[2]);
     if (gridSize < GRID_SIZE) gridSize = GRID_SIZE;
+    if (headless && maxFrames <= 0) maxFrames = DEF_HEADLESS_FRAMES;
+    if (physicsHz <= 0) physicsHz = PHYSICS_BASE_HZ;
 
-    FILE* logFile = fopen("fps_log_secuencial.txt", "w");
 
-    // Incializar el SDL
-    SDL_Init(SDL_INIT_VIDEO);
-    SDL_Window* window = SDL_CreateWindow("Olas - SDL Texture (SECUENCIAL)",
-        SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
-        windowWidth, windowHeight, SDL_WINDOW_SHOWN);
-    SDL_Renderer* renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
+    // Incializar el SDL (en headless no hay ventana, solo el framebuffer)
+    SDL_Window* window = NULL;
+    SDL_Renderer* renderer = NULL;
+    if (headless) {
+        SDL_Init(SDL_INIT_TIMER);
+    } else {
+        SDL_Init(SDL_INIT_VIDEO);
+        window = SDL_CreateWindow("Olas - SDL Texture (SECUENCIAL)",
+            SDL_WINDOWPOS_CENTERED, SDL_WINDOWPOS_CENTERED,
+            windowWidth, windowHeight, SDL_WINDOW_SHOWN);
+        renderer = SDL_CreateRenderer(window, -1, SDL_RENDERER_ACCELERATED);
 
-    screenTexture = SDL_CreateTexture(renderer, 
-        SDL_PIXELFORMAT_ARGB8888, 
-        SDL_TEXTUREACCESS_STREAMING,
-        windowWidth, windowHeight);
+        screenTexture = SDL_CreateTexture(renderer, 
+            SDL_PIXELFORMAT_ARGB8888, 
+            SDL_TEXTUREACCESS_STREAMING,
+            windowWidth, windowHeight);
+    }
     
+    // El archivo de FPS lo escribe un hilo aparte
+    metricsLogOpen(&metricsLog, "fps_log_secuencial.txt");
+
     initRenderBuffers();
-    initSpheres(numSpheres);
+    initSpheres(numSpheres, seed);
     
     // Valores inciiales
     float centerX = gridSize * SCALE / 2;
     float centerZ = gridSize * SCALE / 2;
     float radius = 10.0f;
     float yaw = 0.0f;
-    float camX, camY, camZ;
-    float lookX, lookY, lookZ;
 
     float lightX = centerX + 30.0f;
     float lightY = 25.0f;
@@ -475,17 +1096,28 @@ int main(int argc, char* argv[]) {
 
     int running = 1;
     SDL_Event event;
-    float t = 0;
-    Uint32 lastTime = SDL_GetTicks();
-    Uint32 lastSpawn = lastTime;
-    int spawned = 0;
+    // Paso fijo: el reloj de pared llena un acumulador y se corren los pasos que quepan.
+    // En headless el reloj es simulado (un frame = un paso base) para que sea reproducible
+    double stepSeconds = 1.0 / physicsHz;
+    float stepScale = (float)PHYSICS_BASE_HZ / physicsHz;  // Paso en pasos base
+    double accumulator = 0.0;
+    float t = 0;            // Tiempo de la ola del proximo paso
+    float stepT = 0, prevStepT = 0;  // Tiempo del ultimo paso y del anterior
+    Uint32 lastSpawn = SDL_GetTicks();
+    Uint64 lastCounter = SDL_GetPerformanceCounter();  // Resolución fina: en headless un frame puede durar < 1 ms
+    if (headless) {
+        // Headless: todas desde el inicio
+        for (int i = 0; i < numSpheres; i++) activateSphere(i);
+    }
+    int frames = 0;
+    Uint64 runStart = SDL_GetPerformanceCounter();
 
     int viewMode = 1;
 
     char title[128];
 
     while (running) {
-        while (SDL_PollEvent(&event)) {
+        while (!headless && SDL_PollEvent(&event)) {
             if (event.type == SDL_QUIT) running = 0;
             if (event.type == SDL_KEYDOWN) {
                 if (event.key.keysym.sym == SDLK_1) viewMode = 1;
@@ -499,60 +1131,98 @@ int main(int argc, char* argv[]) {
             }
         }
 
+        stageBegin(STAGE_FRAME);  // Trabajo del frame, sin contar el SDL_Delay
         Uint32 now = SDL_GetTicks();
-        float deltaTime = (now - lastTime) / 1000.0f;
-        lastTime = now;
+        Uint64 counter = SDL_GetPerformanceCounter();
+        float deltaTime = (float)(counter - lastCounter) / SDL_GetPerformanceFrequency();
+        lastCounter = counter;
 
-        if (now - lastSpawn >= SPAWN_INTERVAL && spawned < numSpheres) {
-            spheres[spawned].active = 1;
-            spawned++;
-            lastSpawn = now;
+        stageBegin(STAGE_SPAWN);
+        if (now - lastSpawn >= SPAWN_INTERVAL) {
+            // Una esfera por cada SPAWN_INTERVAL transcurrido, aunque el frame dure mas
+            Uint32 due = (now - lastSpawn) / SPAWN_INTERVAL;
+            for (Uint32 k = 0; k < due && activeCount < numSpheres; k++) {
+                activateSphere(sphereId[activeCount]);
+            }
+            lastSpawn += due * SPAWN_INTERVAL;
         }
+        stageEnd(STAGE_SPAWN);
 
-        updateCameraView(viewMode, centerX, centerZ, radius, &camX, &camY, &camZ, 
-                        &lookX, &lookY, &lookZ, &yaw);
+        stageBegin(STAGE_CAMERA);
+        updateCameraView(viewMode, centerX, centerZ, radius, &yaw, &camera);
+        stageEnd(STAGE_CAMERA);
         
-        updatePhysics(t);
-        resetZBuffer();
-
-        SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
-        SDL_RenderClear(renderer);
-
-        // Precalculo de alturas 
-        float* precomputedHeights = malloc(gridSize * gridSize * sizeof(float));
-        for (int i = 0; i < gridSize; i++) {
-            for (int j = 0; j < gridSize; j++) {
-                float x = i * SCALE;
-                float z = j * SCALE;
-                precomputedHeights[i * gridSize + j] = waveHeight(x, z, t);
-            }
+        // 0..MAX_PHYSICS_STEPS pasos segun el tiempo transcurrido (miden integrar y colisiones por dentro)
+        accumulator += headless ? 1.0 / PHYSICS_BASE_HZ : deltaTime;
+        int steps = 0;
+        while (accumulator >= stepSeconds && steps < MAX_PHYSICS_STEPS) {
+            updatePhysics(t, stepScale);
+            prevStepT = stepT;
+            stepT = t;
+            t += WAVE_TIME_STEP * stepScale;
+            accumulator -= stepSeconds;
+            steps++;
         }
+        if (accumulator >= stepSeconds) accumulator = 0.0;   // Atraso imposible de recuperar: se descarta
 
-        renderScene(renderer, t, lightX, lightY, lightZ,
-                   camX, camY, camZ, lookX, lookY, lookZ,
-                   precomputedHeights);
+        // Se dibuja entre los dos ultimos pasos, segun lo que sobra del acumulador
+        renderAlpha = (float)(accumulator / stepSeconds);
+        float renderT = prevStepT + renderAlpha * (stepT - prevStepT);
 
-        free(precomputedHeights);
+        stageBegin(STAGE_CLEAR);
+        clearRenderBuffers();
+        if (!headless) {
+            SDL_SetRenderDrawColor(renderer, 0, 0, 0, 255);
+            SDL_RenderClear(renderer);
+        }
+        stageEnd(STAGE_CLEAR);
 
-        SDL_UpdateTexture(screenTexture, NULL, frameBuffer, windowWidth * sizeof(Uint32));
-        SDL_RenderCopy(renderer, screenTexture, NULL, NULL);
-        SDL_RenderPresent(renderer);
+        // Alturas y colores del terreno para el instante que se dibuja
+        stageBegin(STAGE_TERRAIN);
+        ensureTerrain(&terrain, gridSize);
+        buildTerrainHeights(&terrain, renderT);
+        shadeTerrain(&terrain, renderT, lightX, lightY, lightZ);
+        stageEnd(STAGE_TERRAIN);
+
+        renderScene(renderer, lightX, lightY, lightZ,
+                   &camera, &terrain);   // Mide raster del terreno y esferas por dentro
+
+        if (!headless) {
+            stageBegin(STAGE_UPLOAD);
+            SDL_UpdateTexture(screenTexture, NULL, frameBuffer, windowWidth * sizeof(Uint32));
+            SDL_RenderCopy(renderer, screenTexture, NULL, NULL);
+            stageEnd(STAGE_UPLOAD);
+
+            stageBegin(STAGE_PRESENT);
+            SDL_RenderPresent(renderer);
+            stageEnd(STAGE_PRESENT);
+        }
 
         float fps = 1.0f / deltaTime;
-        fprintf(logFile, "%.2f\n", fps);
-        fflush(logFile);
-        sprintf(title, "Olas SECUENCIAL - FPS: %.2f - Esferas: %d", fps, spawned);
-        SDL_SetWindowTitle(window, title);
+        metricsLogPush(&metricsLog, fps);
+        stageEnd(STAGE_FRAME);
+        if (!headless) {
+            sprintf(title, "Olas SECUENCIAL - FPS: %.2f - Esferas: %d", fps, activeCount);
+            SDL_SetWindowTitle(window, title);
+            SDL_Delay(16);
+        }
 
-        SDL_Delay(16);
-        t += 0.05f;
+        frames++;
+        if (maxFrames > 0 && frames >= maxFrames) running = 0;
     }
 
-    fclose(logFile);
+    double wallSeconds = (double)(SDL_GetPerformanceCounter() - runStart) / SDL_GetPerformanceFrequency();
+    if (frames > 0) printf("Frames: %d  Tiempo: %.3f s  FPS promedio: %.2f\n", frames, wallSeconds, frames / wallSeconds);
+    dumpStageStats("stage_times_secuencial", frames);
+    printf("Hash framebuffer: %08x\n", frameHash());
+
+    metricsLogClose(&metricsLog);
     freeRenderBuffers();
+    freeTerrain(&terrain);
+    freeProjectedScene(&projected);
     if (screenTexture) SDL_DestroyTexture(screenTexture);
-    SDL_DestroyRenderer(renderer);
-    SDL_DestroyWindow(window);
+    if (renderer) SDL_DestroyRenderer(renderer);
+    if (window) SDL_DestroyWindow(window);
     SDL_Quit();
     return 0;
 }
\ No newline at end of file